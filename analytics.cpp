@@ -0,0 +1,461 @@
+#include "analytics.h"
+#include "commands.h"
+#include "database.h"
+#include "metrics.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Дата возврата незакрытой выдачи
+const int32_t OPEN_LOAN = INT32_MAX;
+// Номер, которого нет в словаре
+const uint32_t NOT_FOUND = UINT32_MAX;
+// Меньше строк на поток не делим: запуск потока дороже такого просмотра
+const size_t MIN_ROWS_PER_THREAD = 64 * 1024;
+
+// Снимок по столбцам. Книги и читатели пронумерованы подряд в порядке ID,
+// выдачи ссылаются на них этими номерами (словарь ID → номер); жанр книги —
+// номер в словаре названий, 0 — без жанра. Даты — дни от 2000-01-01.
+struct Snapshot {
+    std::vector<std::string> genreName;
+
+    std::vector<int32_t> bookId;
+    std::vector<std::string> bookTitle;
+    std::vector<uint32_t> bookGenre;
+
+    std::vector<int32_t> readerId;
+    std::vector<std::string> readerName;
+
+    std::vector<uint32_t> loanBook;
+    std::vector<uint32_t> loanReader;
+    std::vector<int32_t> loanDay;
+    std::vector<int32_t> returnDay;  // OPEN_LOAN, если книга не возвращена
+};
+
+static bool execCommand(PGconn* conn, const char* sql, const char* what) {
+    PGresult* res = PQexec(conn, sql);
+    bool ok = (PQresultStatus(res) == PGRES_COMMAND_OK);
+    if (!ok) {
+        err() << "Ошибка (" << what << "): " << PQresultErrorMessage(res) << std::endl;
+    }
+    PQclear(res);
+    return ok;
+}
+
+// Строка COPY в текстовом формате: поля через табуляцию, спецсимволы
+// экранированы обратной косой чертой, \N — NULL (читается как пустое поле)
+static void splitCopyLine(const char* line, int len, std::vector<std::string>& fields) {
+    size_t count = 0;
+    auto next = [&]() -> std::string& {
+        if (count == fields.size()) fields.emplace_back();
+        std::string& f = fields[count++];
+        f.clear();
+        return f;
+    };
+
+    std::string* field = &next();
+    for (int i = 0; i < len && line[i] != '\n'; ++i) {
+        char c = line[i];
+        if (c == '\t') {
+            field = &next();
+        }
+        else if (c == '\\' && i + 1 < len) {
+            char e = line[++i];
+            switch (e) {
+            case 'N': break;
+            case 't': *field += '\t'; break;
+            case 'n': *field += '\n'; break;
+            case 'r': *field += '\r'; break;
+            case 'b': *field += '\b'; break;
+            case 'f': *field += '\f'; break;
+            case 'v': *field += '\v'; break;
+            default:  *field += e;    break;
+            }
+        }
+        else {
+            *field += c;
+        }
+    }
+    fields.resize(count);
+}
+
+// Выполняет COPY ... TO STDOUT и передаёт строки по одной в onRow
+static bool copyRows(PGconn* conn, const char* name, const char* sql,
+    const std::function<void(const std::vector<std::string>&)>& onRow) {
+    auto start = MetricsClock::now();
+    PGresult* res = PQexec(conn, sql);
+    if (PQresultStatus(res) != PGRES_COPY_OUT) {
+        err() << "Ошибка COPY (" << name << "): " << PQresultErrorMessage(res) << std::endl;
+        PQclear(res);
+        return false;
+    }
+    PQclear(res);
+
+    std::vector<std::string> fields;
+    long long rows = 0;
+    long long bytes = 0;
+    char* buf = nullptr;
+    int n;
+    while ((n = PQgetCopyData(conn, &buf, 0)) > 0) {
+        splitCopyLine(buf, n, fields);
+        onRow(fields);
+        PQfreemem(buf);
+        ++rows;
+        bytes += n;
+    }
+    if (n == -2) {
+        err() << "Ошибка чтения данных: " << PQerrorMessage(conn) << std::endl;
+    }
+
+    bool ok = (n == -1);
+    while ((res = PQgetResult(conn)) != nullptr) {
+        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+            err() << "Ошибка COPY (" << name << "): " << PQresultErrorMessage(res) << std::endl;
+            ok = false;
+        }
+        PQclear(res);
+    }
+    if (ok) recordQuery(std::string("analytics_") + name, MetricsClock::now() - start, rows, bytes);
+    return ok;
+}
+
+// Номер ID в упорядоченном столбце ID
+static uint32_t denseIndex(const std::vector<int32_t>& ids, int32_t id) {
+    auto it = std::lower_bound(ids.begin(), ids.end(), id);
+    if (it == ids.end() || *it != id) return NOT_FOUND;
+    return static_cast<uint32_t>(it - ids.begin());
+}
+
+static bool loadSnapshot(PGconn* conn, Snapshot& s) {
+    s = Snapshot();
+    s.genreName.push_back("(без жанра)");
+    std::vector<int32_t> genreIds;
+    long long skipped = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Все таблицы читаются в одной транзакции, поэтому снимок согласован
+    if (!execCommand(conn, "BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY;",
+            "начало транзакции")) {
+        return false;
+    }
+
+    bool ok = copyRows(conn, "genres",
+        "COPY (SELECT genre_id, name FROM genres ORDER BY genre_id) TO STDOUT;",
+        [&](const std::vector<std::string>& f) {
+            int32_t id;
+            if (f.size() < 2 || !parseInt32(f[0], id)) return;
+            genreIds.push_back(id);
+            s.genreName.push_back(f[1]);
+        });
+
+    ok = ok && copyRows(conn, "books",
+        "COPY (SELECT book_id, title, genre_id FROM books ORDER BY book_id) TO STDOUT;",
+        [&](const std::vector<std::string>& f) {
+            int32_t id, genre;
+            if (f.size() < 3 || !parseInt32(f[0], id)) return;
+            uint32_t g = parseInt32(f[2], genre) ? denseIndex(genreIds, genre) : NOT_FOUND;
+            s.bookId.push_back(id);
+            s.bookTitle.push_back(f[1]);
+            s.bookGenre.push_back(g == NOT_FOUND ? 0 : g + 1);
+        });
+
+    ok = ok && copyRows(conn, "readers",
+        "COPY (SELECT reader_id, full_name FROM readers ORDER BY reader_id) TO STDOUT;",
+        [&](const std::vector<std::string>& f) {
+            int32_t id;
+            if (f.size() < 2 || !parseInt32(f[0], id)) return;
+            s.readerId.push_back(id);
+            s.readerName.push_back(f[1]);
+        });
+
+    // Вся история вместе с архивом. Даты сразу приходят числом дней;
+    // NULL в дате возврата — выдача открыта
+    ok = ok && copyRows(conn, "loans",
+        "COPY (SELECT book_id, reader_id, "
+        "             loan_date - DATE '2000-01-01', "
+        "             return_date - DATE '2000-01-01' "
+        "      FROM loan_history) TO STDOUT;",
+        [&](const std::vector<std::string>& f) {
+            int32_t book, reader, day, returned;
+            if (f.size() < 4 || !parseInt32(f[0], book) || !parseInt32(f[1], reader) ||
+                !parseInt32(f[2], day)) {
+                ++skipped;
+                return;
+            }
+            uint32_t b = denseIndex(s.bookId, book);
+            uint32_t r = denseIndex(s.readerId, reader);
+            if (b == NOT_FOUND || r == NOT_FOUND) {
+                ++skipped;
+                return;
+            }
+            s.loanBook.push_back(b);
+            s.loanReader.push_back(r);
+            s.loanDay.push_back(day);
+            s.returnDay.push_back(parseInt32(f[3], returned) ? returned : OPEN_LOAN);
+        });
+
+    execCommand(conn, ok ? "COMMIT;" : "ROLLBACK;", "завершение транзакции");
+    if (!ok) return false;
+
+    size_t bytes = s.loanBook.size() * (2 * sizeof(uint32_t) + 2 * sizeof(int32_t)) +
+        s.bookId.size() * (sizeof(int32_t) + sizeof(uint32_t)) +
+        s.readerId.size() * sizeof(int32_t);
+    for (const auto& t : s.bookTitle) bytes += sizeof(std::string) + t.capacity();
+    for (const auto& n : s.readerName) bytes += sizeof(std::string) + n.capacity();
+
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    out() << "Снимок: книг " << s.bookId.size() << ", читателей " << s.readerId.size()
+        << ", выдач " << s.loanBook.size() << ", жанров " << genreIds.size()
+        << " (" << bytes / (1024 * 1024) << " МБ), загружен за " << sec << " с\n";
+    if (skipped > 0) {
+        out() << "Пропущено выдач без книги или читателя: " << skipped << "\n";
+    }
+    return true;
+}
+
+// Делит строки [0, rows) на части по числу потоков. Каждый поток считает
+// в свои счётчики (общих записей между потоками нет), затем счётчики
+// складываются. scan(begin, end, counts) — плотный цикл по столбцам.
+template <class Scan>
+static std::vector<uint32_t> parallelCounts(size_t rows, size_t buckets,
+    unsigned threads, Scan scan) {
+    size_t parts = std::min<size_t>(threads, rows / MIN_ROWS_PER_THREAD + 1);
+    std::vector<std::vector<uint32_t>> partial(parts, std::vector<uint32_t>(buckets, 0));
+
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < parts; ++t) {
+        workers.emplace_back([&, t]() {
+            scan(rows * t / parts, rows * (t + 1) / parts, partial[t].data());
+        });
+    }
+    scan(0, rows / parts, partial[0].data());
+    for (auto& w : workers) w.join();
+
+    std::vector<uint32_t>& total = partial[0];
+    for (size_t t = 1; t < parts; ++t) {
+        const uint32_t* p = partial[t].data();
+        for (size_t b = 0; b < buckets; ++b) total[b] += p[b];
+    }
+    return std::move(total);
+}
+
+// k номеров с наибольшими ненулевыми счётчиками; при равенстве — меньший номер
+static std::vector<uint32_t> topK(const std::vector<uint32_t>& counts, size_t k) {
+    std::vector<uint32_t> index;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        if (counts[i] > 0) index.push_back(static_cast<uint32_t>(i));
+    }
+    k = std::min(k, index.size());
+    std::partial_sort(index.begin(), index.begin() + k, index.end(),
+        [&counts](uint32_t a, uint32_t b) {
+            return counts[a] != counts[b] ? counts[a] > counts[b] : a < b;
+        });
+    index.resize(k);
+    return index;
+}
+
+static void printReport(const std::vector<std::string>& columns,
+    const std::vector<std::vector<std::string>>& rows) {
+    PGresult* res = makeTextResult(columns, rows);
+    printResult(res);
+    PQclear(res);
+}
+
+// Период из двух дат YYYY-MM-DD включительно
+static bool readPeriod(const std::vector<std::string>& args, int32_t& from, int32_t& to) {
+    if (args.size() < 3 || !parsePgDate(args[1], from) || !parsePgDate(args[2], to)) {
+        out() << "Укажите период: две даты YYYY-MM-DD.\n";
+        return false;
+    }
+    if (from > to) {
+        out() << "Начало периода позже конца.\n";
+        return false;
+    }
+    return true;
+}
+
+// Необязательное число строк отчёта (по умолчанию 10)
+static bool readLimit(const std::vector<std::string>& args, size_t pos, size_t& k) {
+    k = 10;
+    if (args.size() <= pos) return true;
+    int32_t v;
+    if (!parseInt32(args[pos], v) || v <= 0) {
+        out() << "Число строк должно быть положительным.\n";
+        return false;
+    }
+    k = static_cast<size_t>(v);
+    return true;
+}
+
+// Самые выдаваемые книги за период
+static void topBooks(const Snapshot& s, const std::vector<std::string>& args, unsigned threads) {
+    int32_t from, to;
+    size_t k;
+    if (!readPeriod(args, from, to) || !readLimit(args, 3, k)) return;
+
+    const uint32_t* book = s.loanBook.data();
+    const int32_t* day = s.loanDay.data();
+    uint64_t span = static_cast<uint64_t>(static_cast<int64_t>(to) - from);
+    std::vector<uint32_t> counts = parallelCounts(s.loanBook.size(), s.bookId.size(), threads,
+        [=](size_t begin, size_t end, uint32_t* c) {
+            // Проверка периода без ветвления: дата до начала даёт огромное
+            // беззнаковое смещение
+            for (size_t i = begin; i < end; ++i) {
+                uint64_t offset = static_cast<uint64_t>(static_cast<int64_t>(day[i]) - from);
+                c[book[i]] += (offset <= span);
+            }
+        });
+
+    std::vector<std::vector<std::string>> rows;
+    for (uint32_t b : topK(counts, k)) {
+        rows.push_back({ std::to_string(s.bookId[b]), s.bookTitle[b],
+            s.genreName[s.bookGenre[b]], std::to_string(counts[b]) });
+    }
+    printReport({ "id", "title", "genre", "loans" }, rows);
+}
+
+// Число выдач по жанрам и месяцам за период
+static void genresByMonth(const Snapshot& s, const std::vector<std::string>& args,
+    unsigned threads) {
+    int32_t from, to;
+    if (!readPeriod(args, from, to)) return;
+
+    // Номер месяца для каждого дня периода
+    auto monthNumber = [](int32_t day) {
+        long long y;
+        int m, d;
+        civilFromDays(day, y, m, d);
+        return y * 12 + (m - 1);
+    };
+    long long firstMonth = monthNumber(from);
+    size_t months = static_cast<size_t>(monthNumber(to) - firstMonth + 1);
+    std::vector<uint32_t> monthOfDay(static_cast<size_t>(to - from) + 1);
+    for (size_t i = 0; i < monthOfDay.size(); ++i) {
+        monthOfDay[i] = static_cast<uint32_t>(monthNumber(from + static_cast<int32_t>(i)) - firstMonth);
+    }
+
+    const uint32_t* book = s.loanBook.data();
+    const uint32_t* genre = s.bookGenre.data();
+    const int32_t* day = s.loanDay.data();
+    const uint32_t* month = monthOfDay.data();
+    uint64_t span = monthOfDay.size() - 1;
+    std::vector<uint32_t> counts = parallelCounts(s.loanBook.size(),
+        s.genreName.size() * months, threads,
+        [=](size_t begin, size_t end, uint32_t* c) {
+            for (size_t i = begin; i < end; ++i) {
+                uint64_t offset = static_cast<uint64_t>(static_cast<int64_t>(day[i]) - from);
+                if (offset <= span) ++c[genre[book[i]] * months + month[offset]];
+            }
+        });
+
+    std::vector<std::vector<std::string>> rows;
+    for (size_t g = 0; g < s.genreName.size(); ++g) {
+        for (size_t m = 0; m < months; ++m) {
+            uint32_t n = counts[g * months + m];
+            if (n == 0) continue;
+            long long number = firstMonth + static_cast<long long>(m);
+            char label[32];
+            std::snprintf(label, sizeof(label), "%04lld-%02lld", number / 12, number % 12 + 1);
+            rows.push_back({ s.genreName[g], label, std::to_string(n) });
+        }
+    }
+    printReport({ "genre", "month", "loans" }, rows);
+}
+
+// Читатели с наибольшим числом незакрытых выдач
+static void topReaders(const Snapshot& s, const std::vector<std::string>& args,
+    unsigned threads) {
+    size_t k;
+    if (!readLimit(args, 1, k)) return;
+
+    const uint32_t* reader = s.loanReader.data();
+    const int32_t* returned = s.returnDay.data();
+    std::vector<uint32_t> counts = parallelCounts(s.loanReader.size(), s.readerId.size(), threads,
+        [=](size_t begin, size_t end, uint32_t* c) {
+            for (size_t i = begin; i < end; ++i) c[reader[i]] += (returned[i] == OPEN_LOAN);
+        });
+
+    std::vector<std::vector<std::string>> rows;
+    for (uint32_t r : topK(counts, k)) {
+        rows.push_back({ std::to_string(s.readerId[r]), s.readerName[r],
+            std::to_string(counts[r]) });
+    }
+    printReport({ "id", "full_name", "open_loans" }, rows);
+}
+
+struct Report {
+    const char* name;
+    void (*run)(const Snapshot& s, const std::vector<std::string>& args, unsigned threads);
+    const char* args;
+    const char* description;
+};
+
+static const Report REPORTS[] = {
+    { "top-books",       topBooks,      "с по [N]", "самые выдаваемые книги за период" },
+    { "genres-by-month", genresByMonth, "с по",     "выдачи по жанрам и месяцам" },
+    { "top-readers",     topReaders,    "[N]",      "читатели с наибольшим числом открытых выдач" },
+};
+
+static void printReportHelp() {
+    for (const auto& r : REPORTS) {
+        out() << "  " << r.name << ' ' << r.args << " — " << r.description << "\n";
+    }
+    out() << "  reload — перечитать данные\n"
+        << "  quit — выход\n";
+}
+
+int runAnalytics(PGconn* conn, const AnalyticsOptions& opts) {
+    unsigned threads = opts.threads;
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 4;
+
+    Snapshot snapshot;
+    if (!loadSnapshot(conn, snapshot)) return 1;
+    out() << "Отчёты (даты в виде YYYY-MM-DD):\n";
+    printReportHelp();
+
+    std::string line;
+    std::vector<std::string> words;
+    while (true) {
+        prompt("отчёт> ");
+        if (!std::getline(in(), line)) break;
+        if (!splitCommandLine(line, words)) {
+            out() << "Незакрытая кавычка.\n";
+            continue;
+        }
+        if (words.empty()) continue;
+        if (words[0] == "quit") break;
+
+        if (words[0] == "reload") {
+            if (!loadSnapshot(conn, snapshot)) return 1;
+            continue;
+        }
+
+        const Report* report = nullptr;
+        for (const auto& r : REPORTS) {
+            if (words[0] == r.name) report = &r;
+        }
+        if (report == nullptr) {
+            out() << "Неизвестный отчёт: " << words[0] << "\n";
+            printReportHelp();
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        {
+            OperationScope operation(report->name);
+            report->run(snapshot, words, threads);
+        }
+        double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        out() << "Отчёт построен за " << ms << " мс, потоков: " << threads << "\n";
+    }
+    return 0;
+}
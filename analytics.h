@@ -0,0 +1,14 @@
+#pragma once
+#include <libpq-fe.h>
+
+// Отчёты по выдачам на снимке данных в памяти процесса. Книги, жанры,
+// читатели и выдачи один раз читаются через COPY в одной транзакции только
+// для чтения и хранятся по столбцам; отчёты считаются по снимку в несколько
+// потоков, не обращаясь к базе и не мешая рабочим местам.
+struct AnalyticsOptions {
+    unsigned threads = 0;  // 0 — по числу ядер
+};
+
+// Загружает снимок и выполняет отчёты, по одному в строке ввода.
+// Возвращает код завершения программы.
+int runAnalytics(PGconn* conn, const AnalyticsOptions& opts);
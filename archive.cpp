@@ -0,0 +1,70 @@
+#include "archive.h"
+#include "database.h"
+#include "metrics.h"
+#include "pool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+long long archiveLoanBatch(PGconn* conn, const ArchiveOptions& options) {
+    PGresult* res = execPrepared(conn, "loans_archive_batch",
+        QueryParams().add(options.keepDays).add(options.batchSize));
+
+    long long moved = -1;
+    if (PQresultStatus(res) == PGRES_COMMAND_OK) {
+        moved = std::atoll(PQcmdTuples(res));
+    }
+    else {
+        err() << "Ошибка переноса выдач в архив: "
+            << PQresultErrorMessage(res) << std::endl;
+    }
+    PQclear(res);
+    return moved;
+}
+
+long long archiveLoans(PGconn* conn, const ArchiveOptions& options) {
+    long long total = 0;
+    while (true) {
+        long long moved = archiveLoanBatch(conn, options);
+        if (moved < 0) return -1;
+        total += moved;
+        if (moved < options.batchSize) return total;
+    }
+}
+
+LoanArchiver::LoanArchiver(const std::string& connInfo, const ArchiveOptions& options,
+    int intervalSeconds)
+    : connInfo(connInfo), options(options), interval(std::max(intervalSeconds, 1)) {
+    worker = std::thread(&LoanArchiver::run, this);
+}
+
+LoanArchiver::~LoanArchiver() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void LoanArchiver::run() {
+    PGconn* conn = openConnection(connInfo);
+    if (conn == nullptr) {
+        std::cerr << "Перенос выдач в архив отключён: нет подключения" << std::endl;
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!wake.wait_for(lock, interval, [this] { return stopping; })) {
+        // Пачки переносятся, пока есть что переносить и не пришла остановка
+        OperationScope operation("archive-loans");
+        long long moved = options.batchSize;
+        while (moved >= options.batchSize && !stopping) {
+            lock.unlock();
+            moved = archiveLoanBatch(conn, options);
+            lock.lock();
+        }
+    }
+    lock.unlock();
+    PQfinish(conn);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <libpq-fe.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Перенос закрытых выдач из loans в loans_archive. Каждая пачка переносится
+// отдельной транзакцией, поэтому перенос не держит блокировки долго и не
+// мешает выдачам и возвратам. Вся история доступна в представлении
+// loan_history.
+struct ArchiveOptions {
+    int keepDays = 30;     // закрытые позже остаются в loans
+    int batchSize = 1000;  // выдач в одной пачке
+};
+
+// Переносит одну пачку; возвращает число перенесённых выдач или -1
+long long archiveLoanBatch(PGconn* conn, const ArchiveOptions& options);
+
+// Переносит пачками все подходящие выдачи; возвращает их число или -1
+long long archiveLoans(PGconn* conn, const ArchiveOptions& options);
+
+// Периодический перенос из фонового потока со своим подключением;
+// остановка прерывает перенос между пачками
+class LoanArchiver {
+public:
+    LoanArchiver(const std::string& connInfo, const ArchiveOptions& options,
+        int intervalSeconds);
+    ~LoanArchiver();
+    LoanArchiver(const LoanArchiver&) = delete;
+    LoanArchiver& operator=(const LoanArchiver&) = delete;
+
+private:
+    void run();
+
+    std::string connInfo;
+    ArchiveOptions options;
+    std::chrono::seconds interval;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread worker;
+};
@@ -0,0 +1,901 @@
+// Нагрузочный бенчмарк операций database.cpp.
+// Генератор заполняет базу синтетическим каталогом с перекосом популярности
+// (распределение Ципфа) через COPY, затем каждая операция выполняется через
+// таблицу команд без диалога, как в режиме сервиса. По каждой операции
+// считаются задержки p50/p99/p99.9, пропускная способность и процессорное
+// время клиента; результат пишется в JSON для сравнения запусков.
+//
+// Отдельный сценарий return-hold проверяет конкуренцию: несколько потоков,
+// каждый со своим подключением, одновременно возвращают выдачи одной
+// популярной книги, на которую стоит очередь ожидания.
+//
+// --generate очищает таблицы, а замеры выдают и возвращают книги, поэтому
+// база задаётся явно: --dsn, настройки lab6 не используются.
+//
+// Запуск: ./bench --dsn "dbname=library_bench" --generate 100000 --iterations 2000 --out results.json
+#include "commands.h"
+#include "database.h"
+#include "migrations.h"
+#include "pool.h"
+#include <sys/resource.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Размер блока, которым данные передаются в COPY
+const size_t COPY_CHUNK_SIZE = 256 * 1024;
+
+// Период выдач: LOAN_DAYS дней начиная с 2023-01-01
+const int LOAN_DAYS = 3 * 365;
+
+// Параметры генератора и прогона
+struct BenchOptions {
+    int books = 0;              // 0 — не генерировать, работать с текущими данными
+    double skew = 1.0;          // показатель распределения Ципфа
+    unsigned long long seed = 42;
+    int iterations = 1000;
+    int warmup = 50;
+    bool readOnly = false;
+    int returners = 8;          // потоков в сценарии return-hold, 0 — не запускать
+    std::vector<std::string> only;
+    std::string label;
+    std::string outPath = "bench-results.json";
+};
+
+// Выбор номера 0..n-1 с вероятностью ~ 1/(k+1)^s: немного популярных авторов,
+// книг и читателей и длинный хвост редких
+class ZipfSampler {
+public:
+    ZipfSampler(size_t n, double s) : cdf(std::max<size_t>(n, 1)) {
+        double sum = 0;
+        for (size_t k = 0; k < cdf.size(); ++k) {
+            sum += 1.0 / std::pow(static_cast<double>(k + 1), s);
+            cdf[k] = sum;
+        }
+        for (double& c : cdf) c /= sum;
+    }
+
+    size_t operator()(std::mt19937_64& rng) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        size_t k = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        return std::min(k, cdf.size() - 1);
+    }
+
+private:
+    std::vector<double> cdf;
+};
+
+// Строки для COPY ... FROM STDIN (FORMAT text), отправляемые блоками
+class CopyWriter {
+public:
+    CopyWriter(PGconn* conn, const std::string& sql) : conn(conn) {
+        PGresult* res = PQexec(conn, sql.c_str());
+        ok = (PQresultStatus(res) == PGRES_COPY_IN);
+        if (!ok) err() << "Ошибка COPY: " << PQresultErrorMessage(res) << std::endl;
+        PQclear(res);
+    }
+
+    CopyWriter& field(const std::string& value) {
+        separate();
+        for (char c : value) {
+            switch (c) {
+            case '\\': buffer += "\\\\"; break;
+            case '\t': buffer += "\\t";  break;
+            case '\n': buffer += "\\n";  break;
+            case '\r': buffer += "\\r";  break;
+            default:   buffer += c;
+            }
+        }
+        return *this;
+    }
+
+    CopyWriter& field(long long value) {
+        separate();
+        buffer += std::to_string(value);
+        return *this;
+    }
+
+    CopyWriter& null() {
+        separate();
+        buffer += "\\N";
+        return *this;
+    }
+
+    void endRow() {
+        buffer += '\n';
+        firstField = true;
+        if (buffer.size() >= COPY_CHUNK_SIZE) flush();
+    }
+
+    // Завершает COPY; false, если сервер отклонил данные
+    bool finish() {
+        if (!ok) return false;
+        flush();
+        if (!ok || PQputCopyEnd(conn, nullptr) != 1) {
+            err() << "Ошибка завершения COPY: " << PQerrorMessage(conn) << std::endl;
+            return false;
+        }
+        while (PGresult* res = PQgetResult(conn)) {
+            if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+                err() << "Ошибка загрузки: " << PQresultErrorMessage(res) << std::endl;
+                ok = false;
+            }
+            PQclear(res);
+        }
+        return ok;
+    }
+
+private:
+    void separate() {
+        if (!firstField) buffer += '\t';
+        firstField = false;
+    }
+
+    void flush() {
+        if (ok && !buffer.empty() &&
+            PQputCopyData(conn, buffer.data(), static_cast<int>(buffer.size())) != 1) {
+            err() << "Ошибка передачи данных: " << PQerrorMessage(conn) << std::endl;
+            ok = false;
+        }
+        buffer.clear();
+    }
+
+    PGconn* conn;
+    std::string buffer;
+    bool ok = false;
+    bool firstField = true;
+};
+
+static bool execCommand(PGconn* conn, const std::string& sql, const char* what) {
+    PGresult* res = PQexec(conn, sql.c_str());
+    ExecStatusType status = PQresultStatus(res);
+    bool ok = (status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK);
+    if (!ok) {
+        err() << "Ошибка (" << what << "): " << PQresultErrorMessage(res) << std::endl;
+    }
+    PQclear(res);
+    return ok;
+}
+
+// Даты периода выдач как текст YYYY-MM-DD
+static std::vector<std::string> loanDates() {
+    std::vector<std::string> dates;
+    for (int d = 0; d <= LOAN_DAYS + 60; ++d) {
+        std::tm tm = {};
+        tm.tm_year = 2023 - 1900;
+        tm.tm_mon = 0;
+        tm.tm_mday = 1 + d;
+        tm.tm_hour = 12;
+        std::mktime(&tm);
+        char buf[16];
+        std::strftime(buf, sizeof(buf), "%Y-%m-%d", &tm);
+        dates.push_back(buf);
+    }
+    return dates;
+}
+
+static const char* const SURNAMES[] = {
+    "Иванов", "Смирнов", "Кузнецов", "Попов", "Васильев", "Петров", "Соколов",
+    "Михайлов", "Новиков", "Фёдоров", "Морозов", "Волков", "Алексеев", "Лебедев",
+    "Семёнов", "Егоров", "Павлов", "Козлов", "Степанов", "Николаев", "Орлов",
+    "Андреев", "Макаров", "Никитин", "Захаров", "Зайцев", "Соловьёв", "Борисов",
+};
+static const char* const INITIALS = "АБВГДЕИКЛМНОПРСТЮЯ";
+static const char* const ADJECTIVES[] = {
+    "Тихий", "Последний", "Белый", "Северный", "Тёмный", "Старый", "Забытый",
+    "Красный", "Долгий", "Чужой", "Золотой", "Новый", "Дальний", "Весенний",
+};
+static const char* const NOUNS[] = {
+    "дом", "берег", "сад", "путь", "город", "ветер", "лес", "остров", "мост",
+    "век", "след", "огонь", "переулок", "год", "океан", "маяк", "снег", "час",
+};
+static const char* const COUNTRIES[] = {
+    "Россия", "Великобритания", "США", "Франция", "Германия", "Япония", "Италия",
+};
+static const char* const GENRES[] = {
+    "Роман", "Фантастика", "Детектив", "Ужасы", "Поэзия", "Драма", "Фэнтези",
+    "Биография", "История", "Наука", "Приключения", "Детская литература",
+    "Публицистика", "Философия", "Психология",
+};
+static const char* const LANGUAGES[] = {
+    "Русский", "English", "Deutsch", "Français", "Español", "Italiano",
+    "Українська", "Polski", "中文", "日本語",
+};
+static const char* const CITIES[] = {
+    "Москва", "Санкт-Петербург", "Новосибирск", "Екатеринбург", "Казань",
+};
+
+template <class T, size_t N>
+static const T& pick(const T (&items)[N], std::mt19937_64& rng) {
+    return items[std::uniform_int_distribution<size_t>(0, N - 1)(rng)];
+}
+
+// Одна буква-инициал (два байта UTF-8)
+static std::string initial(std::mt19937_64& rng) {
+    size_t letters = std::char_traits<char>::length(INITIALS) / 2;
+    size_t i = std::uniform_int_distribution<size_t>(0, letters - 1)(rng);
+    return std::string(INITIALS + i * 2, 2) + ".";
+}
+
+static std::string personName(std::mt19937_64& rng) {
+    return std::string(pick(SURNAMES, rng)) + " " + initial(rng) + initial(rng);
+}
+
+// Выдача, запланированная до загрузки книг: от открытых выдач
+// зависит число свободных экземпляров
+struct PlannedLoan {
+    int book;
+    int reader;
+    int day;
+    int returnDay;  // -1 — книга ещё не возвращена
+};
+
+static bool generateData(PGconn* conn, const BenchOptions& opts) {
+    std::mt19937_64 rng(opts.seed);
+    const int books = opts.books;
+    const int authors = std::max(books / 10, 1);
+    const int publishers = std::max(books / 500, 10);
+    const int readers = std::max(books / 2, 1);
+    const int loans = books * 2;
+    const int genres = static_cast<int>(sizeof(GENRES) / sizeof(GENRES[0]));
+    const int languages = static_cast<int>(sizeof(LANGUAGES) / sizeof(LANGUAGES[0]));
+
+    out() << "Генерация: " << books << " книг, " << authors << " авторов, "
+        << readers << " читателей, " << loans << " выдач (перекос " << opts.skew << ")\n";
+    auto start = std::chrono::steady_clock::now();
+
+    if (!execCommand(conn, "BEGIN;", "начало транзакции")) return false;
+    bool ok = execCommand(conn,
+        "TRUNCATE holds, loans, loans_archive, book_cards, books, readers, authors, genres, publishers, languages "
+        "RESTART IDENTITY CASCADE;", "очистка таблиц");
+
+    if (ok) {
+        CopyWriter copy(conn, "COPY authors (author_id, name, country) FROM STDIN;");
+        for (int i = 1; i <= authors; ++i) {
+            copy.field(i).field(personName(rng)).field(pick(COUNTRIES, rng)).endRow();
+        }
+        ok = copy.finish();
+    }
+    if (ok) {
+        CopyWriter copy(conn, "COPY genres (genre_id, name) FROM STDIN;");
+        for (int i = 1; i <= genres; ++i) copy.field(i).field(GENRES[i - 1]).endRow();
+        ok = copy.finish();
+    }
+    if (ok) {
+        CopyWriter copy(conn, "COPY publishers (publisher_id, name, city) FROM STDIN;");
+        for (int i = 1; i <= publishers; ++i) {
+            copy.field(i).field("Издательство " + std::string(pick(NOUNS, rng)) + " " +
+                std::to_string(i)).field(pick(CITIES, rng)).endRow();
+        }
+        ok = copy.finish();
+    }
+    if (ok) {
+        CopyWriter copy(conn, "COPY languages (language_id, name) FROM STDIN;");
+        for (int i = 1; i <= languages; ++i) copy.field(i).field(LANGUAGES[i - 1]).endRow();
+        ok = copy.finish();
+    }
+
+    // Экземпляры и выдачи: популярные книги выдаются чаще,
+    // активные читатели берут больше
+    ZipfSampler copiesShare(10, 1.5);
+    std::vector<int> copiesTotal(books + 1), copiesAvailable(books + 1);
+    for (int b = 1; b <= books; ++b) {
+        copiesTotal[b] = 1 + static_cast<int>(copiesShare(rng));
+        copiesAvailable[b] = copiesTotal[b];
+    }
+
+    ZipfSampler bookPopularity(books, opts.skew);
+    ZipfSampler readerActivity(readers, opts.skew);
+    std::vector<PlannedLoan> planned(loans);
+    for (auto& l : planned) {
+        l.book = 1 + static_cast<int>(bookPopularity(rng));
+        l.reader = 1 + static_cast<int>(readerActivity(rng));
+        l.day = std::uniform_int_distribution<int>(0, LOAN_DAYS)(rng);
+        // Открыты около 5% выдач, и только пока есть свободный экземпляр
+        bool open = std::uniform_int_distribution<int>(0, 19)(rng) == 0 &&
+            copiesAvailable[l.book] > 0;
+        if (open) {
+            --copiesAvailable[l.book];
+            l.returnDay = -1;
+        }
+        else {
+            l.returnDay = l.day + std::uniform_int_distribution<int>(1, 45)(rng);
+        }
+    }
+
+    if (ok) {
+        ZipfSampler authorOutput(authors, opts.skew);
+        ZipfSampler genreShare(genres, opts.skew);
+        ZipfSampler publisherShare(publishers, opts.skew);
+        ZipfSampler languageShare(languages, 2.0);
+        std::normal_distribution<double> pages(320, 120);
+        std::exponential_distribution<double> age(1.0 / 25);
+
+        CopyWriter copy(conn,
+            "COPY books (book_id, title, author_id, genre_id, publisher_id, language_id, "
+            "            year, pages, copies_total, copies_available) FROM STDIN;");
+        for (int b = 1; b <= books; ++b) {
+            std::string title = std::string(pick(ADJECTIVES, rng)) + " " +
+                pick(NOUNS, rng) + " " + std::to_string(b);
+            copy.field(b).field(title)
+                .field(1 + static_cast<long long>(authorOutput(rng)))
+                .field(1 + static_cast<long long>(genreShare(rng)))
+                .field(1 + static_cast<long long>(publisherShare(rng)))
+                .field(1 + static_cast<long long>(languageShare(rng)))
+                .field(std::max(1800LL, 2025 - static_cast<long long>(age(rng))))
+                .field(std::max(24LL, static_cast<long long>(pages(rng))))
+                .field(copiesTotal[b]).field(copiesAvailable[b]).endRow();
+        }
+        ok = copy.finish();
+    }
+    if (ok) {
+        CopyWriter copy(conn, "COPY readers (reader_id, full_name, phone, email) FROM STDIN;");
+        for (int r = 1; r <= readers; ++r) {
+            std::string phone = "+7 9" + std::to_string(10 + r % 90) + " " +
+                std::to_string(100 + r % 900) + "-" + std::to_string(10 + r % 90) +
+                "-" + std::to_string(10 + r / 90 % 90);
+            copy.field(r).field(personName(rng)).field(phone)
+                .field("reader" + std::to_string(r) + "@example.org").endRow();
+        }
+        ok = copy.finish();
+    }
+    if (ok) {
+        std::vector<std::string> dates = loanDates();
+        CopyWriter copy(conn,
+            "COPY loans (book_id, reader_id, loan_date, return_date) FROM STDIN;");
+        for (const auto& l : planned) {
+            copy.field(l.book).field(l.reader).field(dates[l.day]);
+            if (l.returnDay < 0) copy.null();
+            else copy.field(dates[l.returnDay]);
+            copy.endRow();
+        }
+        ok = copy.finish();
+    }
+
+    // Последовательности продолжают нумерацию после загруженных ID
+    ok = ok && execCommand(conn,
+        "SELECT setval(pg_get_serial_sequence('authors', 'author_id'), (SELECT MAX(author_id) FROM authors)), "
+        "       setval(pg_get_serial_sequence('genres', 'genre_id'), (SELECT MAX(genre_id) FROM genres)), "
+        "       setval(pg_get_serial_sequence('publishers', 'publisher_id'), (SELECT MAX(publisher_id) FROM publishers)), "
+        "       setval(pg_get_serial_sequence('languages', 'language_id'), (SELECT MAX(language_id) FROM languages)), "
+        "       setval(pg_get_serial_sequence('books', 'book_id'), GREATEST((SELECT MAX(book_id) FROM books), 1)), "
+        "       setval(pg_get_serial_sequence('readers', 'reader_id'), GREATEST((SELECT MAX(reader_id) FROM readers), 1)), "
+        "       setval(pg_get_serial_sequence('loans', 'loan_id'), GREATEST((SELECT MAX(loan_id) FROM loans), 1));",
+        "последовательности");
+
+    if (!ok) {
+        execCommand(conn, "ROLLBACK;", "откат");
+        return false;
+    }
+    if (!execCommand(conn, "COMMIT;", "фиксация")) return false;
+    execCommand(conn, "ANALYZE authors, genres, publishers, languages, books, book_cards, readers, "
+        "loans, loans_archive;",
+        "сбор статистики");
+
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    out() << "Данные загружены за " << sec << " с\n";
+    return true;
+}
+
+// Поток, который только считает выведенные байты: вывод операций в бенчмарке
+// форматируется полностью, но никуда не пишется
+class CountingBuffer : public std::streambuf {
+public:
+    long long count = 0;
+
+protected:
+    int overflow(int c) override {
+        if (c != traits_type::eof()) ++count;
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char*, std::streamsize n) override {
+        count += n;
+        return n;
+    }
+};
+
+// Размеры данных, от которых выбираются аргументы операций
+struct BenchContext {
+    BenchContext(int books, int readers, int authors, int genres, int publishers,
+        double skew, unsigned long long seed)
+        : rng(seed), books(books), readers(readers), authors(authors),
+          readerPick(readers, skew), authorPick(authors, skew),
+          genrePick(genres, skew), publisherPick(publishers, skew),
+          dates(loanDates()) {}
+
+    std::mt19937_64 rng;
+    int books;
+    int readers;
+    int authors;
+    ZipfSampler readerPick;
+    ZipfSampler authorPick;
+    ZipfSampler genrePick;
+    ZipfSampler publisherPick;
+    std::vector<std::string> dates;
+    std::vector<std::string> openLoans;
+    size_t nextOpenLoan = 0;
+};
+
+struct Scenario {
+    const char* command;
+    bool writes;
+    std::function<std::vector<std::string>(BenchContext&)> args;
+};
+
+static std::string randomId(BenchContext& ctx, const ZipfSampler& popularity) {
+    return std::to_string(1 + popularity(ctx.rng));
+}
+
+static std::string randomDate(BenchContext& ctx) {
+    return ctx.dates[std::uniform_int_distribution<int>(0, LOAN_DAYS)(ctx.rng)];
+}
+
+static const char* randomOp(BenchContext& ctx) {
+    static const char* const ops[] = { "<", ">", "=" };
+    return pick(ops, ctx.rng);
+}
+
+// Сценарии по одному на команду; ID берутся с тем же перекосом, что и в данных
+static std::vector<Scenario> scenarios() {
+    return {
+        { "list-books", false, [](BenchContext&) {
+            return std::vector<std::string>{}; } },
+        { "free-books", false, [](BenchContext&) {
+            return std::vector<std::string>{}; } },
+        { "books-by-year", false, [](BenchContext& ctx) {
+            int year = std::uniform_int_distribution<int>(1900, 2025)(ctx.rng);
+            return std::vector<std::string>{ randomOp(ctx), std::to_string(year) }; } },
+        { "books-by-pages", false, [](BenchContext& ctx) {
+            int pages = std::uniform_int_distribution<int>(50, 800)(ctx.rng);
+            return std::vector<std::string>{ randomOp(ctx), std::to_string(pages) }; } },
+        { "books-by-author", false, [](BenchContext& ctx) {
+            return std::vector<std::string>{ randomId(ctx, ctx.authorPick) }; } },
+        { "books-by-genre", false, [](BenchContext& ctx) {
+            return std::vector<std::string>{ randomId(ctx, ctx.genrePick) }; } },
+        { "books-by-publisher", false, [](BenchContext& ctx) {
+            return std::vector<std::string>{ randomId(ctx, ctx.publisherPick) }; } },
+        { "filter-books", false, [](BenchContext& ctx) {
+            int from = std::uniform_int_distribution<int>(1900, 2000)(ctx.rng);
+            return std::vector<std::string>{ std::to_string(from), std::to_string(from + 25),
+                "", "", "", randomId(ctx, ctx.genrePick), "", "", "да" }; } },
+        { "search-books", false, [](BenchContext& ctx) {
+            return std::vector<std::string>{
+                std::string(pick(ADJECTIVES, ctx.rng)) + " " + pick(NOUNS, ctx.rng) }; } },
+        { "list-loans", false, [](BenchContext&) {
+            return std::vector<std::string>{}; } },
+        { "list-readers", false, [](BenchContext&) {
+            return std::vector<std::string>{}; } },
+        { "reader-loans", false, [](BenchContext& ctx) {
+            return std::vector<std::string>{ randomId(ctx, ctx.readerPick) }; } },
+        { "reference", false, [](BenchContext&) {
+            return std::vector<std::string>{}; } },
+        { "loan", true, [](BenchContext& ctx) {
+            std::string book = std::to_string(
+                std::uniform_int_distribution<int>(1, ctx.books)(ctx.rng));
+            return std::vector<std::string>{ book, randomId(ctx, ctx.readerPick),
+                randomDate(ctx) }; } },
+        { "return", true, [](BenchContext& ctx) {
+            // Дата возврата позже любой даты выдачи
+            std::string loan = ctx.openLoans.empty() ? "1"
+                : ctx.openLoans[ctx.nextOpenLoan++ % ctx.openLoans.size()];
+            return std::vector<std::string>{ loan, ctx.dates.back() }; } },
+        { "add-reader", true, [](BenchContext& ctx) {
+            return std::vector<std::string>{ personName(ctx.rng), "+7 900 000-00-00",
+                "bench@example.org" }; } },
+    };
+}
+
+// Результаты одной операции
+struct OperationStats {
+    std::string name;
+    std::vector<double> latencies;  // мкс
+    int errors = 0;
+    double wallSeconds = 0;
+    double cpuUserSeconds = 0;
+    double cpuSystemSeconds = 0;
+    long long bytes = 0;
+};
+
+static double cpuSeconds(const timeval& tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Перцентиль по ближайшему рангу; latencies отсортированы
+static double percentile(const std::vector<double>& latencies, double p) {
+    if (latencies.empty()) return 0;
+    size_t rank = static_cast<size_t>(std::ceil(p * latencies.size()));
+    return latencies[std::min(std::max<size_t>(rank, 1), latencies.size()) - 1];
+}
+
+static int queryInt(PGconn* conn, const char* sql) {
+    PGresult* res = PQexec(conn, sql);
+    int value = 0;
+    if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) == 1) {
+        value = std::atoi(PQgetvalue(res, 0, 0));
+    }
+    PQclear(res);
+    return value;
+}
+
+// Открытые выдачи для сценария возврата; загружаются перед ним,
+// чтобы в список попали и выдачи из сценария loan
+static std::vector<std::string> openLoans(PGconn* conn, int limit) {
+    std::string n = std::to_string(limit);
+    const char* params[1] = { n.c_str() };
+    PGresult* res = PQexecParams(conn,
+        "SELECT loan_id FROM loans WHERE return_date IS NULL "
+        "ORDER BY loan_id DESC LIMIT $1::int;", 1, nullptr, params, nullptr, nullptr, 0);
+    std::vector<std::string> ids;
+    if (PQresultStatus(res) == PGRES_TUPLES_OK) {
+        for (int i = 0; i < PQntuples(res); ++i) ids.push_back(PQgetvalue(res, i, 0));
+    }
+    PQclear(res);
+    return ids;
+}
+
+static OperationStats runScenario(PGconn* conn, const Scenario& s,
+    BenchContext& ctx, const BenchOptions& opts) {
+    OperationStats stats;
+    stats.name = s.command;
+    const Command* cmd = findCommand(s.command);
+
+    CountingBuffer outBuf, errBuf;
+    std::ostream output(&outBuf), errors(&errBuf);
+
+    rusage before = {}, after = {};
+    for (int i = -opts.warmup; i < opts.iterations; ++i) {
+        if (i == 0) {
+            outBuf.count = 0;
+            getrusage(RUSAGE_SELF, &before);
+        }
+
+        std::string answers;
+        for (const auto& a : s.args(ctx)) answers += a + "\n";
+        std::istringstream input(answers);
+        long long errBefore = errBuf.count;
+
+        auto start = std::chrono::steady_clock::now();
+        {
+            SessionScope scope(input, output, errors);
+            cmd->run(conn);
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        if (i < 0) continue;
+        double us = std::chrono::duration<double, std::micro>(end - start).count();
+        stats.latencies.push_back(us);
+        stats.wallSeconds += us / 1e6;
+        if (errBuf.count != errBefore) ++stats.errors;
+    }
+    getrusage(RUSAGE_SELF, &after);
+
+    stats.cpuUserSeconds = cpuSeconds(after.ru_utime) - cpuSeconds(before.ru_utime);
+    stats.cpuSystemSeconds = cpuSeconds(after.ru_stime) - cpuSeconds(before.ru_stime);
+    stats.bytes = outBuf.count;
+    std::sort(stats.latencies.begin(), stats.latencies.end());
+    return stats;
+}
+
+// Подготовка сценария return-hold: у книги остаются только выданные
+// экземпляры (count новых выдач), и на неё встают в очередь до count
+// читателей. Возвращает ID новых выдач.
+static std::vector<int> prepareHoldContention(PGconn* conn, const BenchContext& ctx,
+    int bookId, int count) {
+    std::string book = std::to_string(bookId);
+    std::string n = std::to_string(count);
+    std::string readers = std::to_string(ctx.readers);
+    const char* params[4] = { book.c_str(), n.c_str(), readers.c_str(), ctx.dates.front().c_str() };
+
+    std::vector<int> ids;
+    if (!execCommand(conn, "BEGIN;", "начало транзакции")) return ids;
+    PGresult* res = PQexecParams(conn,
+        "UPDATE books "
+        "SET copies_total = copies_total - copies_available + $2::int, "
+        "    copies_available = 0 "
+        "WHERE book_id = $1::int;", 2, nullptr, params, nullptr, nullptr, 0);
+    bool ok = (PQresultStatus(res) == PGRES_COMMAND_OK);
+    PQclear(res);
+
+    if (ok) {
+        res = PQexecParams(conn,
+            "INSERT INTO holds (book_id, reader_id) "
+            "SELECT $1::int, r FROM generate_series(1, LEAST($2::int, $3::int)) r "
+            "ON CONFLICT DO NOTHING;", 3, nullptr, params, nullptr, nullptr, 0);
+        ok = (PQresultStatus(res) == PGRES_COMMAND_OK);
+        PQclear(res);
+    }
+    if (ok) {
+        res = PQexecParams(conn,
+            "INSERT INTO loans (book_id, reader_id, loan_date) "
+            "SELECT $1::int, 1 + (g - 1) % $3::int, $4::date "
+            "FROM generate_series(1, $2::int) g "
+            "RETURNING loan_id;", 4, nullptr, params, nullptr, nullptr, 0);
+        ok = (PQresultStatus(res) == PGRES_TUPLES_OK);
+        if (ok) {
+            for (int i = 0; i < PQntuples(res); ++i) ids.push_back(std::atoi(PQgetvalue(res, i, 0)));
+        }
+        else {
+            err() << "Ошибка подготовки очереди: " << PQresultErrorMessage(res) << std::endl;
+        }
+        PQclear(res);
+    }
+
+    if (!ok || !execCommand(conn, "COMMIT;", "фиксация")) {
+        execCommand(conn, "ROLLBACK;", "откат");
+        ids.clear();
+    }
+    return ids;
+}
+
+// Параллельные возвраты одной книги с очередью: каждый поток со своим
+// подключением возвращает свою долю выдач по одной. Пропускная способность
+// считается по общему времени прогона, а не по сумме задержек.
+static OperationStats runHoldContention(PGconn* conn, const std::string& connInfo,
+    const BenchContext& ctx, const BenchOptions& opts) {
+    OperationStats stats;
+    stats.name = "return-hold";
+
+    // Самая популярная книга генератора — первая
+    std::vector<int> loanIds = prepareHoldContention(conn, ctx, 1, opts.iterations);
+    if (loanIds.empty()) {
+        stats.errors = opts.iterations;
+        return stats;
+    }
+
+    std::vector<PGconn*> conns;
+    for (int t = 0; t < opts.returners; ++t) {
+        PGconn* c = openConnection(connInfo);
+        if (c == nullptr) break;
+        conns.push_back(c);
+    }
+    if (conns.empty()) {
+        stats.errors = opts.iterations;
+        return stats;
+    }
+
+    std::vector<std::vector<double>> latencies(conns.size());
+    std::vector<int> errors(conns.size(), 0);
+    std::atomic<int> handed(0);
+    const std::string& date = ctx.dates.back();
+
+    rusage before = {}, after = {};
+    getrusage(RUSAGE_SELF, &before);
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < conns.size(); ++t) {
+        threads.emplace_back([&, t]() {
+            CountingBuffer outBuf, errBuf;
+            std::ostream output(&outBuf), errs(&errBuf);
+            std::istringstream input;
+            SessionScope scope(input, output, errs);
+            for (size_t i = t; i < loanIds.size(); i += conns.size()) {
+                auto begin = std::chrono::steady_clock::now();
+                std::vector<ReturnResult> r = returnLoans(conns[t], { loanIds[i] }, date);
+                auto end = std::chrono::steady_clock::now();
+                latencies[t].push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+                if (r.empty() || !r[0].returned) ++errors[t];
+                else if (r[0].holdLoanId != 0) ++handed;
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+
+    stats.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    getrusage(RUSAGE_SELF, &after);
+    for (PGconn* c : conns) PQfinish(c);
+
+    for (size_t t = 0; t < conns.size(); ++t) {
+        stats.latencies.insert(stats.latencies.end(), latencies[t].begin(), latencies[t].end());
+        stats.errors += errors[t];
+    }
+    stats.cpuUserSeconds = cpuSeconds(after.ru_utime) - cpuSeconds(before.ru_utime);
+    stats.cpuSystemSeconds = cpuSeconds(after.ru_stime) - cpuSeconds(before.ru_stime);
+    std::sort(stats.latencies.begin(), stats.latencies.end());
+
+    std::cout << " потоков " << conns.size() << ", выдано по очереди "
+        << handed << " из " << loanIds.size() << ";";
+    return stats;
+}
+
+static std::string jsonString(const std::string& s) {
+    std::string r = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') r += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            r += buf;
+        }
+        else {
+            r += c;
+        }
+    }
+    return r + "\"";
+}
+
+static bool writeJson(const std::string& path, PGconn* conn, const BenchOptions& opts,
+    const BenchContext& ctx, const std::vector<OperationStats>& results) {
+    std::ofstream file(path);
+    if (!file) {
+        err() << "Не удалось открыть " << path << std::endl;
+        return false;
+    }
+
+    char finished[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(finished, sizeof(finished), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    file << "{\n"
+        << "  \"label\": " << jsonString(opts.label) << ",\n"
+        << "  \"finished_at\": \"" << finished << "\",\n"
+        << "  \"server_version\": " << PQserverVersion(conn) << ",\n"
+        << "  \"page_size\": " << pageSize() << ",\n"
+        << "  \"iterations\": " << opts.iterations << ",\n"
+        << "  \"warmup\": " << opts.warmup << ",\n"
+        << "  \"seed\": " << opts.seed << ",\n"
+        << "  \"data\": { \"books\": " << ctx.books << ", \"readers\": " << ctx.readers
+        << ", \"authors\": " << ctx.authors << ", \"skew\": " << opts.skew << " },\n"
+        << "  \"operations\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        double n = std::max<double>(r.latencies.size(), 1);
+        file << "    { \"name\": " << jsonString(r.name)
+            << ", \"count\": " << r.latencies.size()
+            << ", \"errors\": " << r.errors
+            << ", \"p50_us\": " << percentile(r.latencies, 0.50)
+            << ", \"p99_us\": " << percentile(r.latencies, 0.99)
+            << ", \"p999_us\": " << percentile(r.latencies, 0.999)
+            << ", \"max_us\": " << (r.latencies.empty() ? 0 : r.latencies.back())
+            << ", \"ops_per_sec\": " << (r.wallSeconds > 0 ? r.latencies.size() / r.wallSeconds : 0)
+            << ", \"cpu_user_us_per_op\": " << r.cpuUserSeconds * 1e6 / n
+            << ", \"cpu_sys_us_per_op\": " << r.cpuSystemSeconds * 1e6 / n
+            << ", \"output_bytes_per_op\": " << r.bytes / n
+            << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+    return static_cast<bool>(file);
+}
+
+static void printSummary(const std::vector<OperationStats>& results) {
+    std::vector<std::vector<std::string>> rows;
+    auto fixed = [](double v) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.1f", v);
+        return std::string(buf);
+    };
+    for (const auto& r : results) {
+        double n = std::max<double>(r.latencies.size(), 1);
+        rows.push_back({ r.name, std::to_string(r.latencies.size()), std::to_string(r.errors),
+            fixed(percentile(r.latencies, 0.50)), fixed(percentile(r.latencies, 0.99)),
+            fixed(percentile(r.latencies, 0.999)),
+            fixed(r.wallSeconds > 0 ? r.latencies.size() / r.wallSeconds : 0),
+            fixed((r.cpuUserSeconds + r.cpuSystemSeconds) * 1e6 / n) });
+    }
+    PGresult* res = makeTextResult({ "операция", "n", "ошибок", "p50 мкс", "p99 мкс",
+        "p99.9 мкс", "оп/с", "CPU мкс/оп" }, rows);
+    printResult(res);
+    PQclear(res);
+}
+
+static void printUsage(const char* program) {
+    std::cout << "Использование: " << program << " --dsn СТРОКА [параметры]\n"
+        << "  --dsn СТРОКА      подключение к отдельной базе для замеров; её данные\n"
+        << "                    изменяются и не восстанавливаются\n"
+        << "  --generate N      заменить данные базы синтетическим каталогом из N книг\n"
+        << "  --skew S          перекос популярности (Ципф), по умолчанию 1.0\n"
+        << "  --seed N          зерно генератора\n"
+        << "  --iterations N    замеров на операцию (0 — только генерация)\n"
+        << "  --warmup N        прогревочных вызовов на операцию\n"
+        << "  --only a,b,...    только перечисленные команды\n"
+        << "  --read-only       без операций, изменяющих данные\n"
+        << "  --returners N     потоков параллельного возврата в return-hold (8)\n"
+        << "  --page-size N     размер страницы списков\n"
+        << "  --label ТЕКСТ     метка запуска (версия, ветка)\n"
+        << "  --out ФАЙЛ        файл результатов JSON (bench-results.json)\n";
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opts;
+    std::string connInfo;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (arg == "--dsn" && hasValue) connInfo = argv[++i];
+        else if (arg == "--generate" && hasValue) opts.books = std::atoi(argv[++i]);
+        else if (arg == "--skew" && hasValue) opts.skew = std::atof(argv[++i]);
+        else if (arg == "--seed" && hasValue) opts.seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--iterations" && hasValue) opts.iterations = std::atoi(argv[++i]);
+        else if (arg == "--warmup" && hasValue) opts.warmup = std::atoi(argv[++i]);
+        else if (arg == "--read-only") opts.readOnly = true;
+        else if (arg == "--returners" && hasValue) opts.returners = std::atoi(argv[++i]);
+        else if (arg == "--page-size" && hasValue) setPageSize(std::atoi(argv[++i]));
+        else if (arg == "--label" && hasValue) opts.label = argv[++i];
+        else if (arg == "--out" && hasValue) opts.outPath = argv[++i];
+        else if (arg == "--only" && hasValue) {
+            std::stringstream list(argv[++i]);
+            std::string name;
+            while (std::getline(list, name, ',')) opts.only.push_back(name);
+        }
+        else {
+            printUsage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    if (connInfo.empty()) {
+        std::cerr << "Укажите базу для замеров: --dsn СТРОКА. Бенчмарк изменяет данные "
+            "и не восстанавливает их, рабочую базу использовать нельзя." << std::endl;
+        return 1;
+    }
+
+    {
+        PGconn* conn = PQconnectdb(connInfo.c_str());
+        checkConn(conn);
+        bool ok = applyMigrations(conn);
+        if (ok && opts.books > 0) ok = generateData(conn, opts);
+        PQfinish(conn);
+        if (!ok) return 1;
+    }
+    if (opts.iterations <= 0) return 0;
+
+    PGconn* conn = openConnection(connInfo);
+    if (conn == nullptr) return 1;
+
+    BenchContext ctx(
+        queryInt(conn, "SELECT COALESCE(MAX(book_id), 0) FROM books;"),
+        queryInt(conn, "SELECT COALESCE(MAX(reader_id), 0) FROM readers;"),
+        queryInt(conn, "SELECT COALESCE(MAX(author_id), 0) FROM authors;"),
+        queryInt(conn, "SELECT COALESCE(MAX(genre_id), 0) FROM genres;"),
+        queryInt(conn, "SELECT COALESCE(MAX(publisher_id), 0) FROM publishers;"),
+        opts.skew, opts.seed + 1);
+    if (ctx.books == 0 || ctx.readers == 0) {
+        std::cerr << "В базе нет книг или читателей: запустите с --generate N" << std::endl;
+        PQfinish(conn);
+        return 1;
+    }
+
+    std::vector<OperationStats> results;
+    for (const auto& s : scenarios()) {
+        if (s.writes && opts.readOnly) continue;
+        if (!opts.only.empty() &&
+            std::find(opts.only.begin(), opts.only.end(), s.command) == opts.only.end()) {
+            continue;
+        }
+        if (std::string(s.command) == "return") {
+            ctx.openLoans = openLoans(conn, opts.warmup + opts.iterations);
+            ctx.nextOpenLoan = 0;
+        }
+        std::cout << s.command << "..." << std::flush;
+        results.push_back(runScenario(conn, s, ctx, opts));
+        std::cout << " p50 " << percentile(results.back().latencies, 0.5) << " мкс\n";
+    }
+
+    bool holdSelected = opts.only.empty() ||
+        std::find(opts.only.begin(), opts.only.end(), "return-hold") != opts.only.end();
+    if (!opts.readOnly && opts.returners > 0 && holdSelected) {
+        std::cout << "return-hold..." << std::flush;
+        results.push_back(runHoldContention(conn, connInfo, ctx, opts));
+        std::cout << " p50 " << percentile(results.back().latencies, 0.5) << " мкс\n";
+    }
+
+    printSummary(results);
+    bool written = writeJson(opts.outPath, conn, opts, ctx, results);
+    if (written) std::cout << "Результаты: " << opts.outPath << "\n";
+    PQfinish(conn);
+    return written ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+// Микробенчмарк ширины ячеек: displayWidth против прежней реализации
+// через std::wstring_convert. Запуск: ./bench_width [итераций]
+#include "textwidth.h"
+#include <chrono>
+#include <codecvt>
+#include <cstdlib>
+#include <iostream>
+#include <locale>
+#include <string>
+#include <vector>
+
+// Прежняя реализация getVisualLength из database.cpp
+static int legacyVisualLength(const std::string& s) {
+    std::wstring_convert<std::codecvt_utf8<wchar_t>> conv;
+    std::wstring ws = conv.from_bytes(s);
+    return static_cast<int>(ws.length());
+}
+
+static std::vector<std::string> sampleCells() {
+    std::vector<std::string> base = {
+        "1", "1866", "Есть в наличии", "Нет в наличии",
+        "Преступление и наказание", "Война и мир", "Сияние", "1984",
+        "Достоевский Ф.М.", "Толстой Л.Н.", "Оруэлл Дж.", "Кинг С.",
+        "Роман", "Фантастика", "Эксмо", "Питер", "АСТ", "Русский",
+        "English", "Deutsch", "Français",
+        "Nineteen Eighty-Four: A Novel (Penguin Modern Classics)",
+        "Братья Карамазов. Роман в четырёх частях с эпилогом",
+        "ivan@mail.ru", "2024-01-10",
+    };
+    // Таблица строк как в широком каталоге: те же ячейки в разных сочетаниях
+    std::vector<std::string> cells;
+    for (size_t i = 0; i < base.size(); ++i) {
+        for (size_t j = 0; j < base.size(); ++j) {
+            cells.push_back(base[i] + (j % 3 == 0 ? " " + base[j] : ""));
+        }
+    }
+    return cells;
+}
+
+template <class F>
+static double run(const char* name, const std::vector<std::string>& cells,
+    int iterations, size_t bytes, F f) {
+    long long sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; ++it) {
+        for (const auto& c : cells) sum += f(c);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double sec = std::chrono::duration<double>(end - start).count();
+    double calls = static_cast<double>(cells.size()) * iterations;
+    std::cout << name << ": " << sec * 1e9 / calls << " нс/ячейка, "
+        << bytes * static_cast<double>(iterations) / sec / (1 << 20) << " МБ/с"
+        << " (контрольная сумма " << sum << ")\n";
+    return sec;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 200;
+    std::vector<std::string> cells = sampleCells();
+
+    size_t bytes = 0;
+    for (const auto& c : cells) {
+        bytes += c.size();
+        if (displayWidth(c) != legacyVisualLength(c)) {
+            std::cerr << "Расхождение ширины: " << c << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << cells.size() << " ячеек, " << bytes << " байт, "
+        << iterations << " итераций\n";
+    double legacy = run("wstring_convert", cells, iterations, bytes, legacyVisualLength);
+    double fast = run("displayWidth   ", cells, iterations, bytes,
+        [](const std::string& s) { return displayWidth(s); });
+    std::cout << "Ускорение: " << legacy / fast << "x\n";
+    return 0;
+}
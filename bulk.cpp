@@ -0,0 +1,354 @@
+#include "bulk.h"
+#include "database.h"
+#include "metrics.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Размер блока, которым файл передаётся серверу
+const size_t COPY_CHUNK_SIZE = 256 * 1024;
+
+static bool execCommand(PGconn* conn, const char* sql, const char* what) {
+    PGresult* res = PQexec(conn, sql);
+    ExecStatusType status = PQresultStatus(res);
+    bool ok = (status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK);
+    if (!ok) {
+        err() << "Ошибка (" << what << "): "
+            << PQresultErrorMessage(res) << std::endl;
+    }
+    PQclear(res);
+    return ok;
+}
+
+static void rollback(PGconn* conn) {
+    PGresult* res = PQexec(conn, "ROLLBACK;");
+    PQclear(res);
+}
+
+static bool endsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() &&
+        s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Передаёт файл (без строки заголовка) в уже начатый COPY FROM STDIN
+static bool streamFile(PGconn* conn, std::ifstream& file, long long& bytesSent) {
+    std::string header;
+    std::getline(file, header);
+
+    std::vector<char> buffer(COPY_CHUNK_SIZE);
+    while (file) {
+        file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        std::streamsize n = file.gcount();
+        if (n <= 0) break;
+        if (PQputCopyData(conn, buffer.data(), static_cast<int>(n)) != 1) {
+            err() << "Ошибка передачи данных: " << PQerrorMessage(conn) << std::endl;
+            PQputCopyEnd(conn, "ошибка передачи данных");
+            return false;
+        }
+        bytesSent += n;
+    }
+
+    if (PQputCopyEnd(conn, nullptr) != 1) {
+        err() << "Ошибка завершения COPY: " << PQerrorMessage(conn) << std::endl;
+        return false;
+    }
+
+    bool ok = true;
+    while (PGresult* res = PQgetResult(conn)) {
+        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+            err() << "Ошибка загрузки файла: "
+                << PQresultErrorMessage(res) << std::endl;
+            ok = false;
+        }
+        PQclear(res);
+    }
+    return ok;
+}
+
+void importBooks(PGconn* conn) {
+    std::string path;
+    prompt("Файл каталога (.csv или .tsv, первая строка — заголовок):\n"
+        "  title, author, genre, publisher, language, year, pages, copies\n"
+        "Путь: ");
+    std::getline(in(), path);
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        err() << "Не удалось открыть файл.\n";
+        return;
+    }
+
+    const char* copyQuery = endsWith(path, ".csv")
+        ? "COPY book_import FROM STDIN (FORMAT csv);"
+        : "COPY book_import FROM STDIN (FORMAT text);";
+
+    auto start = std::chrono::steady_clock::now();
+
+    if (!execCommand(conn, "BEGIN;", "начало транзакции")) return;
+
+    if (!execCommand(conn,
+        "CREATE TEMP TABLE book_import ("
+        "    title     text, "
+        "    author    text, "
+        "    genre     text, "
+        "    publisher text, "
+        "    language  text, "
+        "    year      int, "
+        "    pages     int, "
+        "    copies    int"
+        ") ON COMMIT DROP;", "временная таблица")) {
+        rollback(conn);
+        return;
+    }
+
+    PGresult* res = PQexec(conn, copyQuery);
+    if (PQresultStatus(res) != PGRES_COPY_IN) {
+        err() << "Ошибка COPY: " << PQresultErrorMessage(res) << std::endl;
+        PQclear(res);
+        rollback(conn);
+        return;
+    }
+    PQclear(res);
+
+    long long bytesSent = 0;
+    auto copyStart = MetricsClock::now();
+    if (!streamFile(conn, file, bytesSent)) {
+        rollback(conn);
+        return;
+    }
+    recordQuery("book_import_copy", MetricsClock::now() - copyStart, 0, bytesSent);
+
+    // Недостающие авторы, жанры, издательства и языки добавляются пачкой.
+    // Пустое поле (NULL в CSV, пустая строка в TSV) справочником не
+    // считается: такие строки отклоняются при слиянии.
+    const char* missingRefs[] = {
+        "INSERT INTO authors (name) "
+        "SELECT DISTINCT s.author FROM book_import s "
+        "WHERE s.author <> '' "
+        "  AND NOT EXISTS (SELECT 1 FROM authors a WHERE a.name = s.author);",
+        "INSERT INTO genres (name) "
+        "SELECT DISTINCT s.genre FROM book_import s "
+        "WHERE s.genre <> '' "
+        "  AND NOT EXISTS (SELECT 1 FROM genres g WHERE g.name = s.genre);",
+        "INSERT INTO publishers (name) "
+        "SELECT DISTINCT s.publisher FROM book_import s "
+        "WHERE s.publisher <> '' "
+        "  AND NOT EXISTS (SELECT 1 FROM publishers p WHERE p.name = s.publisher);",
+        "INSERT INTO languages (name) "
+        "SELECT DISTINCT s.language FROM book_import s "
+        "WHERE s.language <> '' "
+        "  AND NOT EXISTS (SELECT 1 FROM languages l WHERE l.name = s.language);",
+    };
+    for (const char* q : missingRefs) {
+        if (!execCommand(conn, q, "справочники")) {
+            rollback(conn);
+            return;
+        }
+    }
+
+    // Тот же оператор пополнения, что в addBook, сразу для всех книг
+    // файла: строки одной книги складываются, и каждая книга добавляется
+    // или пополняется ровно один раз. Строки без названия или с пустым
+    // справочником не загружаются, а учитываются как отклонённые.
+    const char* mergeQuery =
+        "WITH valid AS ("
+        "         SELECT * FROM book_import "
+        "         WHERE title <> '' AND author <> '' AND genre <> '' "
+        "           AND publisher <> '' AND language <> ''), "
+        "     src AS ("
+        "         SELECT s.title, a.author_id, g.genre_id, p.publisher_id, "
+        "                l.language_id, s.year, s.pages, "
+        "                SUM(COALESCE(s.copies, 1))::int AS copies, "
+        "                COUNT(*) AS source_rows "
+        "         FROM valid s "
+        "         JOIN (SELECT name, MIN(author_id) AS author_id "
+        "               FROM authors GROUP BY name) a ON a.name = s.author "
+        "         JOIN (SELECT name, MIN(genre_id) AS genre_id "
+        "               FROM genres GROUP BY name) g ON g.name = s.genre "
+        "         JOIN (SELECT name, MIN(publisher_id) AS publisher_id "
+        "               FROM publishers GROUP BY name) p ON p.name = s.publisher "
+        "         JOIN (SELECT name, MIN(language_id) AS language_id "
+        "               FROM languages GROUP BY name) l ON l.name = s.language "
+        "         GROUP BY s.title, a.author_id, g.genre_id, p.publisher_id, "
+        "                  l.language_id, s.year, s.pages), "
+        "     merged AS ("
+        "         INSERT INTO books AS b (title, author_id, genre_id, publisher_id, "
+        "                                 language_id, year, pages, "
+        "                                 copies_total, copies_available) "
+        "         SELECT title, author_id, genre_id, publisher_id, "
+        "                language_id, year, pages, copies, copies "
+        "         FROM src"
+        BOOK_UPSERT_CONFLICT ") "
+        "SELECT (SELECT COALESCE(SUM(source_rows), 0) FROM src), "
+        "       (SELECT COUNT(*) FROM book_import) - "
+        "           (SELECT COALESCE(SUM(source_rows), 0) FROM src), "
+        "       (SELECT COUNT(*) FROM merged WHERE NOT inserted), "
+        "       (SELECT COUNT(*) FROM merged WHERE inserted);";
+
+    auto mergeStart = MetricsClock::now();
+    res = PQexec(conn, mergeQuery);
+    recordQuery("book_import_merge", MetricsClock::now() - mergeStart, res);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        err() << "Ошибка слияния каталога: "
+            << PQresultErrorMessage(res) << std::endl;
+        PQclear(res);
+        rollback(conn);
+        return;
+    }
+    std::string rows = PQgetvalue(res, 0, 0);
+    std::string rejected = PQgetvalue(res, 0, 1);
+    std::string updated = PQgetvalue(res, 0, 2);
+    std::string inserted = PQgetvalue(res, 0, 3);
+    PQclear(res);
+
+    if (!execCommand(conn, "COMMIT;", "фиксация")) return;
+
+    double sec = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    long long rowCount = std::stoll(rows);
+
+    out() << "Загружено строк: " << rowCount
+        << " (" << bytesSent / 1024 << " КБ)\n";
+    if (rejected != "0") {
+        out() << "Отклонено строк без названия, автора, жанра, издательства "
+            "или языка: " << rejected << "\n";
+    }
+    out() << "Пополнено книг: " << updated
+        << ", добавлено новых: " << inserted << "\n";
+    out() << "Время: " << sec << " с, "
+        << (sec > 0 ? static_cast<long long>(rowCount / sec) : rowCount)
+        << " строк/с\n";
+}
+
+// Наборы данных для выгрузки: имя и запрос с уже подставленными названиями
+static const char* const EXPORT_SETS[][2] = {
+    { "books",
+      "SELECT book_id, title, author, genre, publisher, language, year, pages, "
+      "       copies_total, copies_available "
+      "FROM book_cards ORDER BY book_id" },
+    { "loans",
+      "SELECT l.loan_id, l.book_id, b.title, l.reader_id, r.full_name, "
+      "       l.loan_date, l.return_date "
+      "FROM loan_history l "
+      "JOIN books b   ON l.book_id = b.book_id "
+      "JOIN readers r ON l.reader_id = r.reader_id "
+      "ORDER BY l.loan_id" },
+    { "readers",
+      "SELECT reader_id, full_name, phone, email "
+      "FROM readers ORDER BY reader_id" },
+};
+
+// Просит сервер прервать текущий запрос подключения
+static void cancelQuery(PGconn* conn) {
+    PGcancel* cancel = PQgetCancel(conn);
+    if (cancel == nullptr) return;
+    char message[256];
+    PQcancel(cancel, message, sizeof(message));
+    PQfreeCancel(cancel);
+}
+
+void exportData(PGconn* conn) {
+    std::string set, format, path;
+    prompt("Что выгрузить (books, loans, readers): ");
+    std::getline(in(), set);
+
+    const char* select = nullptr;
+    for (const auto& e : EXPORT_SETS) {
+        if (set == e[0]) select = e[1];
+    }
+    if (select == nullptr) {
+        err() << "Неизвестный набор данных.\n";
+        return;
+    }
+
+    prompt("Формат (csv, jsonl): ");
+    std::getline(in(), format);
+
+    std::string copyQuery;
+    if (format == "csv") {
+        copyQuery = std::string("COPY (") + select + ") TO STDOUT (FORMAT csv, HEADER);";
+    }
+    else if (format == "jsonl") {
+        // JSON уже экранирован сервером; CSV с управляющими символами
+        // в роли кавычки и разделителя выводит его без изменений
+        copyQuery = std::string("COPY (SELECT row_to_json(t) FROM (") + select +
+            ") t) TO STDOUT (FORMAT csv, QUOTE E'\\x01', DELIMITER E'\\x02');";
+    }
+    else {
+        err() << "Неизвестный формат.\n";
+        return;
+    }
+
+    prompt("Файл: ");
+    std::getline(in(), path);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        err() << "Не удалось создать файл.\n";
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    PGresult* res = PQexec(conn, copyQuery.c_str());
+    if (PQresultStatus(res) != PGRES_COPY_OUT) {
+        err() << "Ошибка COPY: " << PQresultErrorMessage(res) << std::endl;
+        PQclear(res);
+        file.close();
+        std::remove(path.c_str());
+        return;
+    }
+    PQclear(res);
+
+    // Каждая строка COPY сразу пишется в файл, результат целиком не хранится
+    long long lines = 0;
+    long long bytes = 0;
+    bool written = true;
+    char* buf = nullptr;
+    int n;
+    while ((n = PQgetCopyData(conn, &buf, 0)) > 0) {
+        if (written && !file.write(buf, n)) {
+            // Писать больше некуда (например, диск заполнен): выгрузка
+            // отменяется, а оставшиеся строки дочитываются без записи
+            written = false;
+            err() << "Ошибка записи в файл " << path << std::endl;
+            cancelQuery(conn);
+        }
+        PQfreemem(buf);
+        ++lines;
+        bytes += n;
+    }
+    if (n == -2) {
+        err() << "Ошибка чтения данных: " << PQerrorMessage(conn) << std::endl;
+    }
+
+    bool ok = (n == -1);
+    while ((res = PQgetResult(conn)) != nullptr) {
+        // Ошибка отмены после сбоя записи уже сообщена
+        if (PQresultStatus(res) != PGRES_COMMAND_OK && written) {
+            err() << "Ошибка выгрузки: " << PQresultErrorMessage(res) << std::endl;
+            ok = false;
+        }
+        PQclear(res);
+    }
+    file.close();
+    if (written && !file) {
+        err() << "Ошибка записи в файл " << path << std::endl;
+        written = false;
+    }
+    if (!ok || !written) {
+        // Неполный файл не оставляем, чтобы его не приняли за выгрузку
+        std::remove(path.c_str());
+        return;
+    }
+    recordQuery("export_" + set, MetricsClock::now() - start, lines, bytes);
+
+    double sec = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    long long rows = (format == "csv") ? lines - 1 : lines;
+    out() << "Выгружено строк: " << rows << " (" << bytes / 1024 << " КБ) за "
+        << sec << " с\n";
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <libpq-fe.h>
+
+// Массовая загрузка каталога из CSV/TSV через COPY FROM STDIN
+void importBooks(PGconn* conn);
+
+// Выгрузка книг, выдач и читателей в CSV/JSON Lines через COPY TO STDOUT
+void exportData(PGconn* conn);
@@ -0,0 +1,133 @@
+#include "commands.h"
+#include "database.h"
+#include "bulk.h"
+#include "metrics.h"
+#include <ostream>
+#include <sstream>
+
+const std::vector<Command>& commandTable() {
+    static const std::vector<Command> table = {
+        { "list-books",         listBooks,          "" },
+        { "add-book",           addBook,            "название автор_id жанр_id издатель_id язык_id год страниц экземпляров" },
+        { "delete-book",        deleteBook,         "книга_id количество" },
+        { "books-by-year",      booksByYear,        "оператор год" },
+        { "books-by-publisher", booksByPublisher,   "издательство" },
+        { "books-by-genre",     booksByGenre,       "жанр" },
+        { "books-by-pages",     booksByPages,       "оператор страниц" },
+        { "books-by-author",    booksByAuthor,      "автор" },
+        { "free-books",         freeBooks,          "" },
+        { "filter-books",       filterBooks,        "год_от год_до страниц_от страниц_до автор жанр издательство язык да|нет" },
+        { "search-books",       searchBooks,        "\"слова\"" },
+        { "import-books",       importBooks,        "файл" },
+
+        { "list-loans",         listActiveLoans,    "" },
+        { "loan",               loanBook,           "книга_id читатель_id дата" },
+        { "return",             returnBook,         "выдача_id дата" },
+        { "return-batch",       returnBooksBatch,   "\"выдача_id ...\" дата" },
+        { "hold",               holdBook,           "книга_id читатель_id" },
+        { "cancel-hold",        cancelHold,         "заявка_id" },
+        { "book-holds",         bookHolds,          "книга_id" },
+
+        { "list-readers",       listReaders,        "" },
+        { "reader-loans",       readerLoans,        "читатель_id" },
+        { "add-reader",         addReader,          "ФИО телефон email" },
+
+        { "add-author",         addAuthor,          "имя страна" },
+        { "add-genre",          addGenre,           "название" },
+        { "add-publisher",      addPublisher,       "название город" },
+        { "add-language",       addLanguage,        "название" },
+        { "reference",          listReferenceData,  "" },
+
+        { "export",             exportData,         "books|loans|readers csv|jsonl файл" },
+        { "stats",              printQueryStats,    "" },
+    };
+    return table;
+}
+
+const Command* findCommand(const std::string& name) {
+    for (const auto& c : commandTable()) {
+        if (name == c.name) return &c;
+    }
+    return nullptr;
+}
+
+bool splitCommandLine(const std::string& line, std::vector<std::string>& words) {
+    words.clear();
+    std::string word;
+    bool inWord = false;
+    bool quoted = false;
+
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (quoted) {
+            if (c == '\\' && i + 1 < line.size()) {
+                word += line[++i];
+            }
+            else if (c == '"') {
+                quoted = false;
+            }
+            else {
+                word += c;
+            }
+        }
+        else if (c == '"') {
+            quoted = true;
+            inWord = true;
+        }
+        else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            if (inWord) words.push_back(word);
+            word.clear();
+            inWord = false;
+        }
+        else {
+            word += c;
+            inWord = true;
+        }
+    }
+    if (inWord) words.push_back(word);
+    return !quoted;
+}
+
+bool runCommand(PGconn* conn, const std::vector<std::string>& words, std::ostream& output) {
+    return runCommand(conn, words, output, output);
+}
+
+bool runCommand(PGconn* conn, const std::vector<std::string>& words,
+    std::ostream& output, std::ostream& errors) {
+    if (words.empty()) return true;
+
+    const Command* cmd = findCommand(words[0]);
+    if (cmd == nullptr) {
+        errors << "Неизвестная команда: " << words[0] << "\n";
+        return false;
+    }
+
+    std::string answers;
+    for (size_t i = 1; i < words.size(); ++i) {
+        answers += words[i];
+        answers += '\n';
+    }
+
+    std::istringstream input(answers);
+    SessionScope scope(input, output, errors);
+    OperationScope operation(cmd->name);
+    cmd->run(conn);
+    return !operationFailed();
+}
+
+void runOperation(PGconn* conn, void (*run)(PGconn* conn)) {
+    const char* name = "";
+    for (const auto& c : commandTable()) {
+        if (c.run == run) name = c.name;
+    }
+    OperationScope operation(name);
+    run(conn);
+}
+
+void printCommandHelp(std::ostream& output) {
+    for (const auto& c : commandTable()) {
+        output << c.name;
+        if (*c.args != '\0') output << ' ' << c.args;
+        output << '\n';
+    }
+}
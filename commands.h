@@ -0,0 +1,32 @@
+#pragma once
+#include <libpq-fe.h>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Операция, доступная по имени вне меню: в режиме сервиса и в сценариях.
+// Аргументы команды подаются операции по одному как ответы на её вопросы.
+struct Command {
+    const char* name;
+    void (*run)(PGconn* conn);
+    const char* args;
+};
+
+const std::vector<Command>& commandTable();
+const Command* findCommand(const std::string& name);
+
+// Разбивает строку на слова по пробелам; слово с пробелами берётся в кавычки
+bool splitCommandLine(const std::string& line, std::vector<std::string>& words);
+
+// Выполняет команду words[0] с аргументами words[1..], вывод пишет в output.
+// Возвращает false, если команда неизвестна, завершилась ошибкой или отказом.
+bool runCommand(PGconn* conn, const std::vector<std::string>& words, std::ostream& output);
+// То же, но ошибки операции пишутся отдельно от её вывода
+bool runCommand(PGconn* conn, const std::vector<std::string>& words,
+    std::ostream& output, std::ostream& errors);
+
+// Выполняет операцию из меню; в замерах она учитывается под именем команды
+void runOperation(PGconn* conn, void (*run)(PGconn* conn));
+
+// Список команд с аргументами
+void printCommandHelp(std::ostream& output);
@@ -1,105 +1,1049 @@
 #include "database.h"
+#include "metrics.h"
+#include "refcache.h"
+#include "render.h"
 #include <iomanip>
 #include <iostream>
-#include <locale>
-#include <codecvt>
+#include <cstdlib>
 #include <vector>
 #include <string>
 #include <cctype>
 #include <limits>
+#include <map>
+#include <mutex>
+#include <set>
+#include <cerrno>
+#include <poll.h>
+
+// Потоки сеанса текущего потока: консоль или клиент сервиса
+struct SessionStreams {
+    std::istream* in;
+    std::ostream* out;
+    std::ostream* err;
+    bool interactive;
+    bool failed;
+};
+
+static thread_local SessionStreams session = { &std::cin, &std::cout, &std::cerr, true, false };
+
+std::istream& in() { return *session.in; }
+std::ostream& out() { return *session.out; }
+
+std::ostream& err() {
+    session.failed = true;
+    return *session.err;
+}
 
-void checkConn(PGconn* conn) {
+bool operationFailed() {
+    return session.failed;
+}
+
+void prompt(const char* text) {
+    if (session.interactive) out() << text;
+}
+
+SessionScope::SessionScope(std::istream& input, std::ostream& output, std::ostream& errors)
+    : savedIn(session.in), savedOut(session.out), savedErr(session.err),
+      savedInteractive(session.interactive), savedFailed(session.failed) {
+    session = { &input, &output, &errors, false, false };
+}
+
+SessionScope::~SessionScope() {
+    session = { savedIn, savedOut, savedErr, savedInteractive, savedFailed };
+}
+
+// Карточка книги: общая часть запросов списка книг и фильтров. Карточки
+// хранятся готовыми в book_cards и обновляются триггерами (миграция 2).
+#define BOOK_CARD_COLUMNS \
+    "b.book_id AS id, b.title, b.author, b.genre, b.publisher, " \
+    "b.language, b.year, b.pages, b.copies_total, b.copies_available, b.status"
+#define BOOK_CARD_SELECT \
+    "SELECT " BOOK_CARD_COLUMNS " FROM book_cards b "
+
+// Постраничный список: страницы выбираются по ключу сортировки (keyset),
+// а не через OFFSET, поэтому страница N стоит столько же, сколько первая.
+// Параметры запросов: значения фильтра, затем ключ, затем размер страницы.
+struct PagedListing {
+    std::string name;
+    std::string select;
+    std::string filter;
+    int filterParams;
+    std::vector<std::string> keyExprs;
+    std::vector<int> keyColumns;
+    std::string pageOrder;
+    // Типы ключей в параметрах запросов; пустой список — все int
+    std::vector<std::string> keyTypes = {};
+    // Страницы идут по убыванию ключа (например, по релевантности)
+    bool descending = false;
+};
+
+// Номера столбцов карточки книги, по которым идёт сортировка
+const int CARD_ID_COLUMN = 0;
+const int CARD_YEAR_COLUMN = 6;
+const int CARD_PAGES_COLUMN = 7;
+const int CARD_RANK_COLUMN = 11;
+
+static std::vector<PagedListing> buildListings() {
+    std::vector<PagedListing> l = {
+        { "list_books", BOOK_CARD_SELECT, "", 0,
+          { "b.book_id" }, { CARD_ID_COLUMN }, "id" },
+
+        { "list_active_loans",
+          "SELECT l.loan_id, r.full_name, b.title, l.loan_date "
+          "FROM loans l "
+          "JOIN readers r ON l.reader_id = r.reader_id "
+          "JOIN books b   ON l.book_id = b.book_id ",
+          "l.return_date IS NULL", 0,
+          { "l.loan_id" }, { 0 }, "loan_id" },
+
+        { "list_readers",
+          "SELECT r.reader_id AS id, r.full_name, r.phone, r.email, "
+          "       CASE WHEN EXISTS ("
+          "                SELECT 1 FROM loans l "
+          "                WHERE l.reader_id = r.reader_id "
+          "                  AND l.return_date IS NULL"
+          "            ) "
+          "            THEN 'Сейчас есть книги' "
+          "            ELSE 'Сейчас нет книг' "
+          "       END AS status "
+          "FROM readers r ",
+          "", 0,
+          { "r.reader_id" }, { 0 }, "id" },
+
+        // Поиск по названию и автору (миграция 3): слова ищутся по префиксу
+        // в индексе GIN, страницы идут по убыванию релевантности. Заголовок
+        // весит больше автора.
+        { "books_search",
+          "SELECT " BOOK_CARD_COLUMNS ", ts_rank_cd(b.search, q, 32) AS rank "
+          "FROM book_cards b, to_tsquery('russian', $1) q ",
+          "b.search @@ q", 1,
+          { "ts_rank_cd(b.search, q, 32)", "b.book_id" }, { CARD_RANK_COLUMN, CARD_ID_COLUMN },
+          "rank DESC, id DESC", { "real", "int" }, true },
+    };
+
+    return l;
+}
+
+static const std::vector<PagedListing>& pagedListings() {
+    static const std::vector<PagedListing> listings = buildListings();
+    return listings;
+}
+
+static const PagedListing* findListing(const std::string& name) {
+    for (const auto& l : pagedListings()) {
+        if (l.name == name) return &l;
+    }
+    return nullptr;
+}
+
+// Запросы страницы вперёд (<имя>_next) и назад (<имя>_prev)
+static void addPagedStatements(std::vector<PreparedStatement>& r, const PagedListing& l) {
+    std::string keys, params, desc;
+    int n = l.filterParams;
+    for (size_t i = 0; i < l.keyExprs.size(); ++i) {
+        if (i > 0) {
+            keys += ", ";
+            params += ", ";
+            desc += ", ";
+        }
+        keys += l.keyExprs[i];
+        params += "$" + std::to_string(++n) + "::" + (l.keyTypes.empty() ? "int" : l.keyTypes[i]);
+        desc += l.keyExprs[i] + " DESC";
+    }
+    std::string limit = "$" + std::to_string(n + 1) + "::int";
+    std::string where = "WHERE " + (l.filter.empty() ? "" : l.filter + " AND ");
+
+    const char* after = l.descending ? " < " : " > ";
+    const char* before = l.descending ? " > " : " < ";
+    const std::string& forwardOrder = l.descending ? desc : keys;
+    const std::string& backwardOrder = l.descending ? keys : desc;
+
+    r.push_back({ l.name + "_next",
+        l.select + where + "(" + keys + ")" + after + "(" + params + ") "
+        "ORDER BY " + forwardOrder + " LIMIT " + limit + ";", n + 1 });
+    r.push_back({ l.name + "_prev",
+        "SELECT * FROM (" + l.select + where + "(" + keys + ")" + before + "(" + params + ") "
+        "ORDER BY " + backwardOrder + " LIMIT " + limit + ") page "
+        "ORDER BY " + l.pageOrder + ";", n + 1 });
+}
+
+static std::vector<PreparedStatement> buildRegistry() {
+    std::vector<PreparedStatement> r = {
+        { "reader_exists",
+          "SELECT 1 FROM readers WHERE reader_id = $1::int;", 1 },
+        { "book_exists",
+          "SELECT 1 FROM books WHERE book_id = $1::int;", 1 },
+
+        { "reader_insert",
+          "INSERT INTO readers (full_name, phone, email) VALUES ($1, $2, $3);", 3 },
+
+        { "book_upsert",
+          "INSERT INTO books AS b (title, author_id, genre_id, publisher_id, language_id, "
+          "                        year, pages, copies_total, copies_available) "
+          "VALUES ($1, $2::int, $3::int, $4::int, $5::int, $6::int, $7::int, "
+          "        $8::int, $8::int)"
+          BOOK_UPSERT_CONFLICT ";", 8 },
+
+        // Выдача одним оператором: экземпляр списывается только если он есть,
+        // и только тогда создаётся запись о выдаче
+        { "loan_issue",
+          "WITH book AS ("
+          "         SELECT book_id FROM books WHERE book_id = $1::int), "
+          "     reader AS ("
+          "         SELECT reader_id FROM readers WHERE reader_id = $2::int), "
+          "     taken AS ("
+          "         UPDATE books "
+          "         SET copies_available = copies_available - 1 "
+          "         WHERE book_id = $1::int "
+          "           AND copies_available > 0 "
+          "           AND EXISTS (SELECT 1 FROM reader) "
+          "         RETURNING book_id), "
+          "     loan AS ("
+          "         INSERT INTO loans (book_id, reader_id, loan_date) "
+          "         SELECT book_id, $2::int, $3::date FROM taken "
+          "         RETURNING loan_id) "
+          "SELECT CASE "
+          "         WHEN NOT EXISTS (SELECT 1 FROM book)   THEN 1 "
+          "         WHEN NOT EXISTS (SELECT 1 FROM reader) THEN 2 "
+          "         WHEN NOT EXISTS (SELECT 1 FROM loan)   THEN 3 "
+          "         ELSE 0 END AS status, "
+          "       (SELECT loan_id FROM loan) AS loan_id;", 3 },
+
+        // Возврат пачки выдач в одной транзакции: освободившийся экземпляр
+        // сразу выдаётся первому в очереди ожидания (функция миграции 4)
+        { "loans_return",
+          "SELECT loan_id, returned, hold_loan_id "
+          "FROM return_loans($1::int[], $2::date);", 2 },
+
+        // Перенос пачки выдач, закрытых раньше чем $1 дней назад, в архив.
+        // Выдачи, которые сейчас меняет другой сеанс, пропускаются.
+        { "loans_archive_batch",
+          "WITH batch AS ("
+          "         SELECT loan_id FROM loans "
+          "         WHERE return_date < current_date - $1::int "
+          "         ORDER BY return_date, loan_id "
+          "         LIMIT $2::int "
+          "         FOR UPDATE SKIP LOCKED), "
+          "     moved AS ("
+          "         DELETE FROM loans l "
+          "         USING batch "
+          "         WHERE l.loan_id = batch.loan_id "
+          "         RETURNING l.loan_id, l.book_id, l.reader_id, l.loan_date, l.return_date) "
+          "INSERT INTO loans_archive (loan_id, book_id, reader_id, loan_date, return_date) "
+          "SELECT loan_id, book_id, reader_id, loan_date, return_date FROM moved;", 2 },
+
+        // Заявка в очередь: только на книгу без свободных экземпляров и не
+        // больше одной ожидающей заявки читателя на книгу. Позиция — число
+        // ожидающих заявок вместе с новой. Строка книги блокируется: возврат,
+        // который кладёт экземпляр на полку, берёт ту же блокировку и
+        // проверяет очередь заново (return_loans, миграция 9).
+        { "hold_place",
+          "WITH book AS ("
+          "         SELECT book_id, copies_available FROM books WHERE book_id = $1::int "
+          "         FOR UPDATE), "
+          "     reader AS ("
+          "         SELECT reader_id FROM readers WHERE reader_id = $2::int), "
+          "     placed AS ("
+          "         INSERT INTO holds (book_id, reader_id) "
+          "         SELECT book.book_id, reader.reader_id FROM book, reader "
+          "         WHERE book.copies_available <= 0 "
+          "         ON CONFLICT (book_id, reader_id) WHERE status = 'waiting' DO NOTHING "
+          "         RETURNING hold_id) "
+          "SELECT CASE "
+          "         WHEN NOT EXISTS (SELECT 1 FROM book)   THEN 1 "
+          "         WHEN NOT EXISTS (SELECT 1 FROM reader) THEN 2 "
+          "         WHEN (SELECT copies_available FROM book) > 0 THEN 3 "
+          "         WHEN NOT EXISTS (SELECT 1 FROM placed) THEN 4 "
+          "         ELSE 0 END AS status, "
+          "       (SELECT hold_id FROM placed) AS hold_id, "
+          "       (SELECT COUNT(*)::int + 1 FROM holds "
+          "        WHERE book_id = $1::int AND status = 'waiting') AS position;", 2 },
+        { "hold_cancel",
+          "UPDATE holds "
+          "SET status = 'cancelled', closed_at = now() "
+          "WHERE hold_id = $1::int AND status = 'waiting' "
+          "RETURNING hold_id;", 1 },
+        { "book_holds",
+          "SELECT h.hold_id AS hold, r.reader_id, r.full_name, h.placed_at "
+          "FROM holds h "
+          "JOIN readers r ON r.reader_id = h.reader_id "
+          "WHERE h.book_id = $1::int AND h.status = 'waiting' "
+          "ORDER BY h.hold_id;", 1 },
+
+        // Списание экземпляров одним оператором: условие на свободные
+        // экземпляры проверяется под блокировкой строки книги, поэтому
+        // параллельная выдача не может занять списываемый экземпляр.
+        // Книга удаляется, когда списываются все её экземпляры.
+        { "book_remove_copies",
+          "WITH book AS ("
+          "         SELECT book_id FROM books WHERE book_id = $1::int), "
+          "     reduced AS ("
+          "         UPDATE books "
+          "         SET copies_total = copies_total - $2::int, "
+          "             copies_available = copies_available - $2::int "
+          "         WHERE book_id = $1::int "
+          "           AND copies_available >= $2::int "
+          "           AND copies_total > $2::int "
+          "         RETURNING copies_total, copies_available), "
+          "     deleted AS ("
+          "         DELETE FROM books "
+          "         WHERE book_id = $1::int "
+          "           AND copies_available >= $2::int "
+          "           AND copies_total <= $2::int "
+          "         RETURNING book_id) "
+          "SELECT CASE "
+          "         WHEN NOT EXISTS (SELECT 1 FROM book)   THEN 1 "
+          "         WHEN EXISTS (SELECT 1 FROM deleted)    THEN 3 "
+          "         WHEN NOT EXISTS (SELECT 1 FROM reduced) THEN 2 "
+          "         ELSE 0 END AS status, "
+          "       (SELECT copies_total FROM reduced) AS copies_total, "
+          "       (SELECT copies_available FROM reduced) AS copies_available;", 2 },
+
+        { "reader_loans",
+          "SELECT l.loan_id AS loan, b.book_id AS book_id, b.title, "
+          "       b.author, b.genre, b.publisher, b.language, "
+          "       b.year, b.pages, l.loan_date "
+          "FROM loans l "
+          "JOIN book_cards b ON l.book_id = b.book_id "
+          "WHERE l.reader_id = $1::int "
+          "  AND l.return_date IS NULL "
+          "ORDER BY l.loan_id;", 1 },
+
+        { "author_insert",
+          "INSERT INTO authors (name, country) VALUES ($1, $2);", 2 },
+        { "genre_insert",
+          "INSERT INTO genres (name) VALUES ($1);", 1 },
+        { "publisher_insert",
+          "INSERT INTO publishers (name, city) VALUES ($1, $2);", 2 },
+        { "language_insert",
+          "INSERT INTO languages (name) VALUES ($1);", 1 },
+
+        { "ref_authors",
+          "SELECT author_id AS id, name, country "
+          "FROM authors ORDER BY author_id;", 0 },
+        { "ref_genres",
+          "SELECT genre_id AS id, name "
+          "FROM genres ORDER BY genre_id;", 0 },
+        { "ref_publishers",
+          "SELECT publisher_id AS id, name, city "
+          "FROM publishers ORDER BY publisher_id;", 0 },
+        { "ref_languages",
+          "SELECT language_id AS id, name "
+          "FROM languages ORDER BY language_id;", 0 },
+    };
+
+    for (const auto& l : pagedListings()) {
+        addPagedStatements(r, l);
+    }
+
+    return r;
+}
+
+const std::vector<PreparedStatement>& statementRegistry() {
+    static const std::vector<PreparedStatement> registry = buildRegistry();
+    return registry;
+}
+
+// Условия составного фильтра книг. Набор заданных условий (маска) задаёт
+// форму запроса: в WHERE входят только заданные условия, так что сервер
+// может взять индекс по любому из них, а план не зависит от значений.
+// Форм немного (по одной на маску), их запросы готовятся в каждом сеансе
+// перед первым использованием формы в нём.
+const unsigned FILTER_YEAR      = 1u << 0;
+const unsigned FILTER_PAGES     = 1u << 1;
+const unsigned FILTER_AUTHOR    = 1u << 2;
+const unsigned FILTER_GENRE     = 1u << 3;
+const unsigned FILTER_PUBLISHER = 1u << 4;
+const unsigned FILTER_LANGUAGE  = 1u << 5;
+const unsigned FILTER_AVAILABLE = 1u << 6;
+const unsigned FILTER_ALL       = (1u << 7) - 1;
+
+static unsigned filterMask(const BookFilter& f) {
+    unsigned mask = 0;
+    if (f.yearFrom || f.yearTo)   mask |= FILTER_YEAR;
+    if (f.pagesFrom || f.pagesTo) mask |= FILTER_PAGES;
+    if (f.authorId)               mask |= FILTER_AUTHOR;
+    if (f.genreId)                mask |= FILTER_GENRE;
+    if (f.publisherId)            mask |= FILTER_PUBLISHER;
+    if (f.languageId)             mask |= FILTER_LANGUAGE;
+    if (f.availableOnly)          mask |= FILTER_AVAILABLE;
+    return mask;
+}
+
+// Значения параметров в порядке условий формы; у диапазона без одной
+// из границ она заменяется крайним значением int
+static std::vector<std::string> filterValues(const BookFilter& f) {
+    std::vector<std::string> v;
+    auto range = [&v](const std::optional<int>& from, const std::optional<int>& to) {
+        if (!from && !to) return;
+        v.push_back(std::to_string(from.value_or(std::numeric_limits<int>::min())));
+        v.push_back(std::to_string(to.value_or(std::numeric_limits<int>::max())));
+    };
+    range(f.yearFrom, f.yearTo);
+    range(f.pagesFrom, f.pagesTo);
+    for (const auto* id : { &f.authorId, &f.genreId, &f.publisherId, &f.languageId }) {
+        if (*id) v.push_back(std::to_string(**id));
+    }
+    return v;
+}
+
+static PagedListing buildFilterListing(unsigned mask) {
+    std::string filter;
+    int n = 0;
+    auto param = [&n]() { return "$" + std::to_string(++n) + "::int"; };
+    auto add = [&filter](const std::string& condition) {
+        if (!filter.empty()) filter += " AND ";
+        filter += condition;
+    };
+
+    if (mask & FILTER_YEAR) {
+        std::string from = param();
+        add("b.year BETWEEN " + from + " AND " + param());
+    }
+    if (mask & FILTER_PAGES) {
+        std::string from = param();
+        add("b.pages BETWEEN " + from + " AND " + param());
+    }
+    if (mask & FILTER_AUTHOR)    add("b.author_id = " + param());
+    if (mask & FILTER_GENRE)     add("b.genre_id = " + param());
+    if (mask & FILTER_PUBLISHER) add("b.publisher_id = " + param());
+    if (mask & FILTER_LANGUAGE)  add("b.language_id = " + param());
+    if (mask & FILTER_AVAILABLE) add("b.copies_available > 0");
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "books_filter_%02x", mask);
+
+    // Диапазон по году или страницам читается по индексу (год, id) или
+    // (страницы, id), поэтому и страницы списка идут в этом порядке
+    if (mask & FILTER_YEAR) {
+        return { name, BOOK_CARD_SELECT, filter, n,
+            { "b.year", "b.book_id" }, { CARD_YEAR_COLUMN, CARD_ID_COLUMN }, "year, id" };
+    }
+    if (mask & FILTER_PAGES) {
+        return { name, BOOK_CARD_SELECT, filter, n,
+            { "b.pages", "b.book_id" }, { CARD_PAGES_COLUMN, CARD_ID_COLUMN }, "pages, id" };
+    }
+    return { name, BOOK_CARD_SELECT, filter, n, { "b.book_id" }, { CARD_ID_COLUMN }, "id" };
+}
+
+// Формы, уже использованные программой, и их запросы; общие для всех потоков
+static std::mutex filterMutex;
+static std::map<unsigned, PagedListing> filterListings;
+static std::map<std::string, PreparedStatement> filterStatements;
+
+// Формы, подготовленные в сеансе подключения; сеанс определяется PID
+// серверного процесса, после переподключения набор начинается заново
+struct PreparedFilters {
+    int backendPid = 0;
+    std::set<unsigned> masks;
+};
+static std::map<PGconn*, PreparedFilters> preparedFilters;
+
+static const PagedListing& filterListing(PGconn* conn, unsigned mask) {
+    const PagedListing* listing;
+    std::vector<PreparedStatement> statements;
+    {
+        std::lock_guard<std::mutex> lock(filterMutex);
+        auto it = filterListings.find(mask);
+        if (it == filterListings.end()) {
+            it = filterListings.emplace(mask, buildFilterListing(mask)).first;
+            std::vector<PreparedStatement> built;
+            addPagedStatements(built, it->second);
+            for (const auto& st : built) filterStatements.emplace(st.name, st);
+        }
+        listing = &it->second;
+
+        PreparedFilters& prepared = preparedFilters[conn];
+        if (prepared.backendPid != PQbackendPID(conn)) {
+            prepared.backendPid = PQbackendPID(conn);
+            prepared.masks.clear();
+        }
+        if (prepared.masks.count(mask)) return *listing;
+        addPagedStatements(statements, *listing);
+    }
+
+    // Подготовка заранее, а не по SQLSTATE 26000: иначе первый потоковый
+    // вывод формы в сеансе ушёл бы в запасной вывод с результатом целиком
+    // в памяти. Подключение принадлежит вызывающему потоку, поэтому
+    // подготовка идёт без блокировки.
+    if (PQstatus(conn) == CONNECTION_BAD) reconnect(conn);
+    bool ok = true;
+    for (const auto& st : statements) {
+        if (!prepareStatement(conn, st)) ok = false;
+    }
+    if (ok) {
+        std::lock_guard<std::mutex> lock(filterMutex);
+        PreparedFilters& prepared = preparedFilters[conn];
+        if (prepared.backendPid == PQbackendPID(conn)) prepared.masks.insert(mask);
+    }
+    return *listing;
+}
+
+std::vector<PreparedStatement> bookFilterStatements() {
+    std::vector<PreparedStatement> r;
+    for (unsigned bit = 1; bit < FILTER_ALL; bit <<= 1) {
+        addPagedStatements(r, buildFilterListing(bit));
+    }
+    addPagedStatements(r, buildFilterListing(FILTER_ALL));
+    return r;
+}
+
+std::vector<std::string> bookFilterParams(const std::string& statementName,
+    const BookFilter& sample) {
+    unsigned mask;
+    if (std::sscanf(statementName.c_str(), "books_filter_%2x", &mask) != 1) return {};
+    BookFilter f;
+    if (mask & FILTER_YEAR) {
+        f.yearFrom = sample.yearFrom;
+        f.yearTo = sample.yearTo;
+    }
+    if (mask & FILTER_PAGES) {
+        f.pagesFrom = sample.pagesFrom;
+        f.pagesTo = sample.pagesTo;
+    }
+    if (mask & FILTER_AUTHOR)    f.authorId = sample.authorId;
+    if (mask & FILTER_GENRE)     f.genreId = sample.genreId;
+    if (mask & FILTER_PUBLISHER) f.publisherId = sample.publisherId;
+    if (mask & FILTER_LANGUAGE)  f.languageId = sample.languageId;
+    return filterValues(f);
+}
+
+bool prepareStatement(PGconn* conn, const PreparedStatement& st) {
+    PGresult* res = PQprepare(conn, st.name.c_str(), st.sql.c_str(),
+        st.nParams, nullptr);
+    bool ok = (PQresultStatus(res) == PGRES_COMMAND_OK);
+    if (!ok) {
+        err() << "Ошибка подготовки запроса " << st.name << ": "
+            << PQresultErrorMessage(res) << std::endl;
+    }
+    PQclear(res);
+    return ok;
+}
+
+bool prepareStatements(PGconn* conn) {
+    bool ok = true;
+    for (const auto& st : statementRegistry()) {
+        if (!prepareStatement(conn, st)) ok = false;
+    }
+    return ok;
+}
+
+bool reconnect(PGconn* conn) {
+    // Уведомление, а не отказ: после переподключения операция продолжается
+    *session.err << "Соединение потеряно, переподключение..." << std::endl;
+    PQreset(conn);
     if (PQstatus(conn) != CONNECTION_OK) {
-        std::cerr << "Ошибка подключения: " << PQerrorMessage(conn) << std::endl;
-        PQfinish(conn);
-        exit(1);
+        err() << "Ошибка подключения: " << PQerrorMessage(conn) << std::endl;
+        return false;
     }
+    return prepareStatements(conn);
 }
 
-int getVisualLength(const std::string& s) {
-    std::wstring_convert<std::codecvt_utf8<wchar_t>> conv;
-    std::wstring ws = conv.from_bytes(s);
-    return static_cast<int>(ws.length());
+static bool isMissingStatement(const PGresult* res) {
+    // SQLSTATE 26000: подготовленный запрос не найден в сеансе
+    const char* state = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+    return state != nullptr && std::string(state) == "26000";
 }
 
-std::string repeat(const std::string& str, int n) {
-    if (n <= 0) return "";
-    std::string res;
-    res.reserve(str.size() * n);
-    while (n--) res += str;
+static const PreparedStatement* findStatement(const std::string& name) {
+    for (const auto& st : statementRegistry()) {
+        if (st.name == name) return &st;
+    }
+    std::lock_guard<std::mutex> lock(filterMutex);
+    auto it = filterStatements.find(name);
+    return it != filterStatements.end() ? &it->second : nullptr;
+}
+
+// Выполнение с повторной подготовкой запроса, потерянного сеансом
+static PGresult* execPreparedRaw(PGconn* conn, const std::string& name, int nParams,
+    const char* const* values, const int* lengths, const int* formats, int resultFormat) {
+    if (PQstatus(conn) == CONNECTION_BAD) reconnect(conn);
+
+    auto start = MetricsClock::now();
+    PGresult* res = PQexecPrepared(conn, name.c_str(), nParams,
+        values, lengths, formats, resultFormat);
+
+    if (PQstatus(conn) == CONNECTION_BAD) {
+        // Запрос мог успеть выполниться, поэтому не повторяем его,
+        // а только восстанавливаем соединение для следующих операций
+        reconnect(conn);
+        return res;
+    }
+
+    if (isMissingStatement(res)) {
+        const PreparedStatement* st = findStatement(name);
+        if (st != nullptr && prepareStatement(conn, *st)) {
+            PQclear(res);
+            start = MetricsClock::now();
+            res = PQexecPrepared(conn, name.c_str(), nParams,
+                values, lengths, formats, resultFormat);
+        }
+    }
+    recordQuery(name, MetricsClock::now() - start, res);
     return res;
 }
 
-void printCell(const std::string& content, int targetWidth) {
-    int visualLen = getVisualLength(content);
-    int padding = targetWidth - visualLen;
-    if (padding < 0) padding = 0;
-    std::cout << "| " << content << repeat(" ", padding);
+PGresult* execPrepared(PGconn* conn, const std::string& name, int nParams,
+    const char* const* params) {
+    return execPreparedRaw(conn, name, nParams, params, nullptr, nullptr, TEXT_FORMAT);
 }
 
-void printResult(PGresult* res) {
-    ExecStatusType status = PQresultStatus(res);
+PGresult* execPrepared(PGconn* conn, const std::string& name,
+    const QueryParams& params, int resultFormat) {
+    return execPreparedRaw(conn, name, params.size(), params.values(),
+        params.lengths(), params.formats(), resultFormat);
+}
 
-    if (status == PGRES_COMMAND_OK) {
-        std::cout << "Операция выполнена успешно.\n";
-        return;
+// Итог конвейера: первые completed запросов получили ответы полностью;
+// запросы до queued переданы libpq и могли выполниться, хотя ответа нет;
+// остальные на сервер не попали
+struct PipelineProgress {
+    size_t queued = 0;
+    size_t completed = 0;
+};
+
+// Конвейер из n запросов с синхронизацией после каждого: каждый выполняется
+// в своей неявной транзакции. send(i) ставит запрос в очередь libpq,
+// onResult(i, res) получает результаты запроса i и освобождает их.
+// Подключение неблокирующее, отправка чередуется с чтением ответов: иначе
+// при большом пакете клиент ждёт, пока сервер примет запросы, а сервер —
+// пока клиент прочитает результаты. После ошибки отправки ответы на уже
+// отправленные запросы дочитываются; если дочитать нельзя, подключение
+// переустанавливается, чтобы следом можно было выполнять запросы по одному.
+static PipelineProgress runPipeline(PGconn* conn, size_t n,
+    const std::function<bool(size_t index)>& send,
+    const std::function<void(size_t index, PGresult* res)>& onResult) {
+    PipelineProgress progress;
+    if (PQstatus(conn) == CONNECTION_BAD) reconnect(conn);
+    if (n == 0 || PQsetnonblocking(conn, 1) != 0) return progress;
+    if (!PQenterPipelineMode(conn)) {
+        PQsetnonblocking(conn, 0);
+        return progress;
     }
 
-    if (status != PGRES_TUPLES_OK) {
-        std::cerr << "Ошибка: " << PQresultErrorMessage(res) << std::endl;
-        return;
-    }
+    bool sending = true;
+    bool broken = false;
+    while (!broken && (progress.completed < progress.queued || (sending && progress.queued < n))) {
+        // Запросы отправляются, пока libpq успевает передавать их серверу
+        int flushed = PQflush(conn);
+        while (flushed == 0 && sending && progress.queued < n) {
+            if (!send(progress.queued)) {
+                sending = false;
+                break;
+            }
+            // Запрос уже в очереди libpq и может дойти до сервера, даже если
+            // синхронизация не удалась; без неё ответа не дождаться
+            ++progress.queued;
+            if (!PQpipelineSync(conn)) {
+                sending = false;
+                broken = true;
+                break;
+            }
+            flushed = PQflush(conn);
+        }
+        if (flushed < 0) broken = true;
+        if (broken) break;
 
-    int rows = PQntuples(res);
-    int cols = PQnfields(res);
-    std::vector<int> widths(cols, 0);
-
-    for (int j = 0; j < cols; ++j) {
-        widths[j] = getVisualLength(PQfname(res, j));
-        for (int i = 0; i < rows; ++i) {
-            int len = getVisualLength(PQgetvalue(res, i, j));
-            if (len > widths[j]) widths[j] = len;
+        // Разбор всего, что уже пришло
+        if (!PQconsumeInput(conn)) {
+            broken = true;
+            break;
+        }
+        bool progressed = false;
+        bool queryEnded = false;
+        while (progress.completed < progress.queued && !PQisBusy(conn)) {
+            // Результат запроса, nullptr в конце запроса, затем PGRES_PIPELINE_SYNC
+            PGresult* res = PQgetResult(conn);
+            if (res == nullptr) {
+                // Два конца подряд: очередь libpq пуста, хотя ответы ожидаются
+                if (queryEnded || PQstatus(conn) == CONNECTION_BAD) {
+                    broken = true;
+                    break;
+                }
+                queryEnded = true;
+                continue;
+            }
+            queryEnded = false;
+            progressed = true;
+            if (PQresultStatus(res) == PGRES_PIPELINE_SYNC) {
+                PQclear(res);
+                ++progress.completed;
+                continue;
+            }
+            onResult(progress.completed, res);
         }
-        widths[j] += 2;
+        if (broken || PQstatus(conn) == CONNECTION_BAD) {
+            broken = true;
+            break;
+        }
+        if (progressed) continue;
+
+        // Ждём ответов, а пока в буфере остались данные — и возможности писать
+        bool finished = progress.completed == progress.queued && (!sending || progress.queued == n);
+        if (finished) break;
+        pollfd pfd = { PQsocket(conn), POLLIN, 0 };
+        if (flushed == 1) pfd.events |= POLLOUT;
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) broken = true;
+    }
+
+    if (broken || !PQexitPipelineMode(conn)) {
+        // Состояние конвейера неизвестно: ответы не дочитать
+        reconnect(conn);
     }
+    PQsetnonblocking(conn, 0);
+    return progress;
+}
+
+void execPipelined(PGconn* conn, const std::vector<PipelinedQuery>& queries,
+    const std::function<void(size_t index, PGresult* res)>& onResult) {
+    size_t n = queries.size();
+    std::vector<PGresult*> results(n, nullptr);
+    std::vector<bool> retry(n, false);
+    size_t delivered = 0;
+    auto deliver = [&]() {
+        while (delivered < n && results[delivered] != nullptr && !retry[delivered]) {
+            onResult(delivered, results[delivered]);
+            PQclear(results[delivered]);
+            results[delivered] = nullptr;
+            ++delivered;
+        }
+    };
 
-    auto printDiv = [&](char l, char m, char r, char h) {
-        std::cout << l;
-        for (int j = 0; j < cols; ++j) {
-            std::cout << repeat(std::string(1, h), widths[j] + 1);
-            if (j < cols - 1) std::cout << m;
+    auto start = MetricsClock::now();
+    PipelineProgress progress = runPipeline(conn, n,
+        [&](size_t i) {
+            const PipelinedQuery& q = queries[i];
+            return PQsendQueryPrepared(conn, q.name.c_str(), q.params.size(), q.params.values(),
+                q.params.lengths(), q.params.formats(), q.resultFormat) == 1;
+        },
+        [&](size_t i, PGresult* res) {
+            if (results[i] != nullptr) {
+                PQclear(res);
+                return;
+            }
+            results[i] = res;
+            if (isMissingStatement(res)) {
+                retry[i] = true;
+            }
+            else {
+                recordQuery(queries[i].name, MetricsClock::now() - start, res);
+            }
+            deliver();
+        });
+
+    for (size_t i = delivered; i < n; ++i) {
+        if (i >= progress.completed && i < progress.queued) {
+            // Запрос отправлен, но ответ не получен: он мог выполниться,
+            // поэтому не повторяем его
+            PQclear(results[i]);
+            results[i] = PQmakeEmptyPGresult(conn, PGRES_FATAL_ERROR);
+        }
+        else if (results[i] == nullptr || retry[i]) {
+            PQclear(results[i]);
+            const PipelinedQuery& q = queries[i];
+            results[i] = execPrepared(conn, q.name, q.params, q.resultFormat);
         }
-        std::cout << r << "\n";
-        };
+        onResult(i, results[i]);
+        PQclear(results[i]);
+    }
+}
+
+void checkConn(PGconn* conn) {
+    if (PQstatus(conn) != CONNECTION_OK) {
+        err() << "Ошибка подключения: " << PQerrorMessage(conn) << std::endl;
+        PQfinish(conn);
+        exit(1);
+    }
+}
 
-    std::cout << "\n";
-    printDiv('+', '+', '+', '-');
+void printResult(PGresult* res) {
+    auto start = MetricsClock::now();
+    ExecStatusType status = PQresultStatus(res);
 
-    for (int j = 0; j < cols; ++j) {
-        printCell(PQfname(res, j), widths[j]);
+    if (status == PGRES_COMMAND_OK) {
+        OutputBuffer buf(out());
+        rendererFor(outputFormat()).commandOk(buf);
+    }
+    else if (status != PGRES_TUPLES_OK) {
+        err() << "Ошибка: " << PQresultErrorMessage(res) << std::endl;
     }
-    std::cout << "|\n";
+    else {
+        OutputBuffer buf(out());
+        renderResult(buf, res);
+    }
+    recordRender(MetricsClock::now() - start);
+}
 
-    printDiv('+', '+', '+', '-');
+PGresult* makeTextResult(const std::vector<std::string>& columns,
+    const std::vector<std::vector<std::string>>& rows) {
+    PGresult* res = PQmakeEmptyPGresult(nullptr, PGRES_TUPLES_OK);
+    std::vector<PGresAttDesc> attrs(columns.size());
+    for (size_t j = 0; j < columns.size(); ++j) {
+        attrs[j] = {};
+        attrs[j].name = const_cast<char*>(columns[j].c_str());
+        attrs[j].typlen = -1;
+    }
+    PQsetResultAttrs(res, static_cast<int>(attrs.size()), attrs.data());
 
-    for (int i = 0; i < rows; ++i) {
-        for (int j = 0; j < cols; ++j) {
-            printCell(PQgetvalue(res, i, j), widths[j]);
+    for (size_t i = 0; i < rows.size(); ++i) {
+        for (size_t j = 0; j < rows[i].size() && j < columns.size(); ++j) {
+            PQsetvalue(res, static_cast<int>(i), static_cast<int>(j),
+                const_cast<char*>(rows[i][j].c_str()),
+                static_cast<int>(rows[i][j].size()));
         }
-        std::cout << "|\n";
     }
-    printDiv('+', '+', '+', '-');
-    std::cout << std::endl;
+    return res;
 }
 
 void execAndPrint(PGconn* conn, const char* query, int nParams,
     const char* const* params) {
+    auto start = MetricsClock::now();
     PGresult* res = PQexecParams(conn, query, nParams, nullptr,
         params, nullptr, nullptr, 0);
+    recordQuery("adhoc", MetricsClock::now() - start, res);
     printResult(res);
     PQclear(res);
 }
 
+void execPreparedAndPrint(PGconn* conn, const std::string& name, int nParams,
+    const char* const* params) {
+    PGresult* res = execPrepared(conn, name, nParams, params);
+    printResult(res);
+    PQclear(res);
+}
+
+// Сколько строк и байт потоковый вывод держит в памяти,
+// чтобы подобрать ширину столбцов
+const int STREAM_SAMPLE_ROWS = 200;
+const size_t STREAM_SAMPLE_BYTES = 1 << 20;
+
+static size_t rowBytes(const PGresult* res) {
+    size_t bytes = 0;
+    for (int j = 0; j < PQnfields(res); ++j) {
+        bytes += PQgetlength(res, 0, j);
+    }
+    return bytes;
+}
+
+void execPreparedAndStream(PGconn* conn, const std::string& name, int nParams,
+    const char* const* params) {
+    if (PQstatus(conn) == CONNECTION_BAD) reconnect(conn);
+
+    if (!PQsendQueryPrepared(conn, name.c_str(), nParams, params,
+            nullptr, nullptr, 0) ||
+        !PQsetSingleRowMode(conn)) {
+        err() << "Ошибка: " << PQerrorMessage(conn) << std::endl;
+        if (PQstatus(conn) == CONNECTION_BAD) reconnect(conn);
+        return;
+    }
+
+    // Первые строки копятся в выборке, по ней фиксируется ширина столбцов;
+    // дальше каждая строка выводится сразу и освобождается. Форматам без
+    // выравнивания выборка не нужна. Весь вывод идёт через один буфер.
+    const ResultRenderer& renderer = rendererFor(outputFormat());
+    OutputBuffer buf(out());
+    std::vector<PGresult*> sample;
+    size_t sampleBytes = 0;
+    std::vector<int> widths;
+    bool streaming = false;
+    bool missingStatement = false;
+
+    // Вывод идёт вперемешку с приёмом строк: его время вычитается из времени запроса
+    auto start = MetricsClock::now();
+    MetricsClock::duration rendering{};
+    long long rowCount = 0;
+    long long byteCount = 0;
+
+    auto startStreaming = [&](const PGresult* first) {
+        auto renderStart = MetricsClock::now();
+        renderer.begin(buf, first, widths);
+        for (PGresult* r : sample) {
+            renderer.row(buf, r, 0, widths);
+            PQclear(r);
+        }
+        sample.clear();
+        streaming = true;
+        rendering += MetricsClock::now() - renderStart;
+    };
+
+    while (PGresult* res = PQgetResult(conn)) {
+        ExecStatusType status = PQresultStatus(res);
+
+        if (status == PGRES_SINGLE_TUPLE) {
+            size_t bytes = rowBytes(res);
+            ++rowCount;
+            byteCount += bytes;
+            if (!streaming && !renderer.needsWidths()) startStreaming(res);
+            if (streaming) {
+                auto renderStart = MetricsClock::now();
+                renderer.row(buf, res, 0, widths);
+                rendering += MetricsClock::now() - renderStart;
+                PQclear(res);
+                continue;
+            }
+            if (sample.empty()) widths = headerWidths(res);
+            widenToRow(widths, res, 0);
+            sampleBytes += bytes;
+            sample.push_back(res);
+            if (static_cast<int>(sample.size()) >= STREAM_SAMPLE_ROWS ||
+                sampleBytes >= STREAM_SAMPLE_BYTES) {
+                startStreaming(sample.front());
+            }
+            continue;
+        }
+
+        if (status == PGRES_TUPLES_OK) {
+            // Завершающий результат без строк: допечатываем выборку
+            if (!streaming && sample.empty()) {
+                buf.flush();
+                printResult(res);
+            }
+            else {
+                if (!streaming) startStreaming(sample.front());
+                auto renderStart = MetricsClock::now();
+                renderer.end(buf, widths);
+                buf.flush();
+                rendering += MetricsClock::now() - renderStart;
+            }
+        }
+        else {
+            missingStatement = isMissingStatement(res) && !streaming && sample.empty();
+            buf.flush();
+            if (!missingStatement) printResult(res);
+        }
+        PQclear(res);
+    }
+
+    for (PGresult* r : sample) PQclear(r);
+
+    if (!missingStatement) {
+        recordQuery(name, MetricsClock::now() - start - rendering, rowCount, byteCount);
+        recordRender(rendering);
+    }
+
+    if (PQstatus(conn) == CONNECTION_BAD) {
+        reconnect(conn);
+    }
+    else if (missingStatement) {
+        // Сеанс потерял подготовленный запрос: обычное выполнение
+        // подготовит его заново
+        execPreparedAndPrint(conn, name, nParams, params);
+    }
+}
+
+// Размер страницы списков; 0 — весь список потоком
+static int currentPageSize = 50;
+
+void setPageSize(int size) {
+    currentPageSize = size < 0 ? 0 : size;
+}
+
+int pageSize() {
+    return currentPageSize;
+}
+
+// Крайние значения ключа: с них начинается первая страница
+static const char* const KEY_MIN = "-2147483648";
+static const char* const KEY_MAX = "2147483647";
+
+static std::vector<std::string> rowKey(const PGresult* res, int row, const PagedListing& l) {
+    std::vector<std::string> key;
+    for (int col : l.keyColumns) key.push_back(PQgetvalue(res, row, col));
+    return key;
+}
+
+static void browsePaged(PGconn* conn, const PagedListing& listing,
+    const std::vector<std::string>& filterValues) {
+    const std::string& name = listing.name;
+    std::vector<std::string> firstKey;
+    std::vector<std::string> lastKey(listing.keyColumns.size(),
+        listing.descending ? KEY_MAX : KEY_MIN);
+    std::string limit = std::to_string(pageSize());
+
+    auto makeParams = [&](const std::vector<std::string>& key, bool unlimited) {
+        std::vector<const char*> params;
+        for (const auto& v : filterValues) params.push_back(v.c_str());
+        for (const auto& v : key) params.push_back(v.c_str());
+        // NULL в LIMIT снимает ограничение
+        params.push_back(unlimited ? nullptr : limit.c_str());
+        return params;
+    };
+
+    if (pageSize() == 0) {
+        std::vector<const char*> params = makeParams(lastKey, true);
+        execPreparedAndStream(conn, name + "_next",
+            static_cast<int>(params.size()), params.data());
+        return;
+    }
+
+    int page = 0;
+    bool forward = true;
+    while (true) {
+        std::vector<const char*> params = makeParams(forward ? lastKey : firstKey, false);
+        PGresult* res = execPrepared(conn, name + (forward ? "_next" : "_prev"),
+            static_cast<int>(params.size()), params.data());
+
+        if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+            printResult(res);
+            PQclear(res);
+            return;
+        }
+
+        int rows = PQntuples(res);
+        if (rows == 0 && page > 0) {
+            out() << (forward ? "Больше записей нет.\n" : "Это первая страница.\n");
+        }
+        else {
+            page += (page == 0 || forward) ? 1 : -1;
+            if (rows > 0) {
+                firstKey = rowKey(res, 0, listing);
+                lastKey = rowKey(res, rows - 1, listing);
+            }
+            out() << "Страница " << page << "\n";
+            printResult(res);
+        }
+        PQclear(res);
+
+        if (page == 1 && forward && rows < pageSize()) return;  // весь список на одной странице
+
+        std::string cmd;
+        while (true) {
+            prompt("n — следующая страница, p — предыдущая, q — выход: ");
+            if (!std::getline(in(), cmd)) {
+                // Ввод закончился (сценарий): о полной странице нельзя
+                // сказать, последняя ли она
+                if (rows == pageSize()) out() << "Показана одна страница, записей может быть больше.\n";
+                return;
+            }
+            if (cmd != "p" || page > 1) break;
+            out() << "Это первая страница.\n";
+        }
+
+        if (cmd == "n" || cmd.empty()) forward = true;
+        else if (cmd == "p") forward = false;
+        else return;
+    }
+}
+
+void browseListing(PGconn* conn, const std::string& name,
+    const std::vector<std::string>& filterValues) {
+    const PagedListing* listing = findListing(name);
+    if (listing == nullptr) {
+        err() << "Неизвестный список: " << name << std::endl;
+        return;
+    }
+    browsePaged(conn, *listing, filterValues);
+}
+
+void browseBooks(PGconn* conn, const BookFilter& filter) {
+    unsigned mask = filterMask(filter);
+    if (mask == 0) {
+        browseListing(conn, "list_books", {});
+        return;
+    }
+    browsePaged(conn, filterListing(conn, mask), filterValues(filter));
+}
+
 bool isNumber(const std::string& s) {
     if (s.empty()) return false;
     for (char c : s) {
@@ -108,727 +1052,872 @@ bool isNumber(const std::string& s) {
     return true;
 }
 
-bool readerExists(PGconn* conn, const std::string& readerId) {
-    const char* q =
-        "SELECT 1 FROM readers WHERE reader_id = $1::int;";
-    const char* params[1] = { readerId.c_str() };
-    PGresult* res = PQexecParams(conn, q, 1, nullptr, params, nullptr, nullptr, 0);
-    bool ok = (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) > 0);
-    PQclear(res);
-    if (!ok)
-        std::cout << "Читатель с таким ID не найден.\n";
-    return ok;
-}
-
 bool bookExists(PGconn* conn, const std::string& bookId) {
-    const char* q =
-        "SELECT 1 FROM books WHERE book_id = $1::int;";
-    const char* params[1] = { bookId.c_str() };
-    PGresult* res = PQexecParams(conn, q, 1, nullptr, params, nullptr, nullptr, 0);
-    bool ok = (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) > 0);
-    PQclear(res);
+    int32_t id;
+    bool ok = parseInt32(bookId, id);
+    if (ok) {
+        PGresult* res = execPrepared(conn, "book_exists", QueryParams().add(id));
+        ok = (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) > 0);
+        PQclear(res);
+    }
     if (!ok)
-        std::cout << "Книга с таким ID не найдена.\n";
+        err() << "Книга с таким ID не найдена.\n";
     return ok;
 }
 
 bool resolveIdByIdOrName(
     PGconn* conn,
     const std::string& tableName,
-    const std::string& idColumn,
-    const std::string& nameColumn,
     const std::string& userInput,
     const std::string& description,
     std::string& outId
 ) {
     if (userInput.empty()) {
-        std::cout << "Ввод не должен быть пустым.\n";
+        err() << "Ввод не должен быть пустым.\n";
         return false;
     }
 
+    // Справочники берутся из кэша, запросов к серверу здесь нет
+    ReferenceCache& cache = ReferenceCache::instance();
+    cache.poll(conn);
+    std::string name;
+
     // Если пользователь ввёл число — считаем это ID
+    // (число вне диапазона int такого ID иметь не может)
     if (isNumber(userInput)) {
-        std::string q =
-            "SELECT " + idColumn +
-            " FROM " + tableName +
-            " WHERE " + idColumn + " = $1::int;";
-
-        const char* params[1] = { userInput.c_str() };
-        PGresult* res = PQexecParams(conn, q.c_str(), 1, nullptr, params, nullptr, nullptr, 0);
-
-        if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) == 0) {
-            std::cout << "Нет " << description << "а с таким ID.\n";
-            PQclear(res);
+        int32_t id;
+        if (!parseInt32(userInput, id) || !cache.findById(tableName, id, name)) {
+            err() << "Нет " << description << "а с таким ID.\n";
             return false;
         }
-
-        outId = PQgetvalue(res, 0, 0);
-        PQclear(res);
+        outId = userInput;
         return true;
     }
 
     // Поиск по имени (частичное совпадение)
-    std::string ilikeQuery =
-        "SELECT " + idColumn + ", " + nameColumn +
-        " FROM " + tableName +
-        " WHERE " + nameColumn + " ILIKE '%' || $1 || '%' "
-        " ORDER BY " + idColumn + ";";
-
-    const char* params[1] = { userInput.c_str() };
-    PGresult* res = PQexecParams(conn, ilikeQuery.c_str(), 1, nullptr,
-                                 params, nullptr, nullptr, 0);
-
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-        std::cerr << "Ошибка поиска по " << description << ": "
-                  << PQresultErrorMessage(res) << std::endl;
-        PQclear(res);
-        return false;
-    }
+    std::vector<std::pair<int, std::string>> found = cache.search(tableName, userInput);
 
-    int rows = PQntuples(res);
-    if (rows == 0) {
-        std::cout << "Не найден ни один " << description << ".\n";
-        PQclear(res);
+    if (found.empty()) {
+        err() << "Не найден ни один " << description << ".\n";
         return false;
     }
 
-    if (rows == 1) {
-        outId = PQgetvalue(res, 0, 0);
-        PQclear(res);
+    if (found.size() == 1) {
+        outId = std::to_string(found[0].first);
         return true;
     }
 
-    std::cout << "Найдено несколько вариантов. Выберите ID:\n";
+    std::vector<std::vector<std::string>> rows;
+    for (const auto& f : found) {
+        rows.push_back({ std::to_string(f.first), f.second });
+    }
+    out() << "Найдено несколько вариантов. Выберите ID:\n";
+    PGresult* res = makeTextResult({ "id", "name" }, rows);
     printResult(res);
     PQclear(res);
 
     std::string chosenId;
-    std::cout << "Введите ID: ";
-    std::cin >> chosenId;  
+    prompt("Введите ID: ");
+    std::getline(in(), chosenId);
 
     if (!isNumber(chosenId)) {
-        std::cout << "Некорректный ID.\n";
+        err() << "Некорректный ID.\n";
         return false;
     }
 
-    std::string qCheck =
-        "SELECT " + idColumn +
-        " FROM " + tableName +
-        " WHERE " + idColumn + " = $1::int;";
-
-    const char* paramsCheck[1] = { chosenId.c_str() };
-    PGresult* resCheck = PQexecParams(conn, qCheck.c_str(), 1, nullptr,
-                                      paramsCheck, nullptr, nullptr, 0);
-
-    if (PQresultStatus(resCheck) != PGRES_TUPLES_OK || PQntuples(resCheck) == 0) {
-        std::cout << "Нет " << description << "а с таким ID.\n";
-        PQclear(resCheck);
+    int32_t id;
+    if (!parseInt32(chosenId, id) || !cache.findById(tableName, id, name)) {
+        err() << "Нет " << description << "а с таким ID.\n";
         return false;
     }
 
-    outId = PQgetvalue(resCheck, 0, 0);
-    PQclear(resCheck);
+    outId = chosenId;
     return true;
 }
 
 void listBooks(PGconn* conn) {
-    const char* query =
-        "SELECT b.book_id AS id, b.title, a.name AS author, g.name AS genre, "
-        "       p.name AS publisher, l.name AS language, b.year, b.pages, "
-        "       b.copies_total, b.copies_available, "
-        "       CASE WHEN b.copies_available > 0 "
-        "            THEN 'Есть в наличии' ELSE 'Нет в наличии' END AS status "
-        "FROM books b "
-        "JOIN authors a    ON b.author_id = a.author_id "
-        "JOIN genres g     ON b.genre_id = g.genre_id "
-        "JOIN publishers p ON b.publisher_id = p.publisher_id "
-        "JOIN languages l  ON b.language_id = l.language_id "
-        "ORDER BY b.book_id;";
-    execAndPrint(conn, query, 0, nullptr);
+    browseListing(conn, "list_books", {});
 }
 
 void listActiveLoans(PGconn* conn) {
-    const char* query =
-        "SELECT l.loan_id, r.full_name, b.title, l.loan_date "
-        "FROM loans l "
-        "JOIN readers r ON l.reader_id = r.reader_id "
-        "JOIN books b   ON l.book_id = b.book_id "
-        "WHERE l.return_date IS NULL "
-        "ORDER BY l.loan_id;";
-    execAndPrint(conn, query, 0, nullptr);
+    browseListing(conn, "list_active_loans", {});
 }
 
 void addReader(PGconn* conn) {
     std::string name, phone, email;
-    std::cout << "ФИО: ";
-    std::getline(std::cin, name);
-    std::cout << "Телефон: ";
-    std::getline(std::cin, phone);
-    std::cout << "Email: ";
-    std::getline(std::cin, email);
-
-    const char* query =
-        "INSERT INTO readers (full_name, phone, email) VALUES ($1, $2, $3);";
+    prompt("ФИО: ");
+    std::getline(in(), name);
+    prompt("Телефон: ");
+    std::getline(in(), phone);
+    prompt("Email: ");
+    std::getline(in(), email);
 
     const char* params[3] = { name.c_str(), phone.c_str(), email.c_str() };
-    execAndPrint(conn, query, 3, params);
+    execPreparedAndPrint(conn, "reader_insert", 3, params);
 }
 
 void addBook(PGconn* conn) {
     std::string title, authorId, genreId, publisherId, languageId, year, pages;
     std::string copies;
 
-    std::cout << "Название: ";
-    std::getline(std::cin, title);
-    std::cout << "ID автора: ";
-    std::getline(std::cin, authorId);
-    std::cout << "ID жанра: ";
-    std::getline(std::cin, genreId);
-    std::cout << "ID издателя: ";
-    std::getline(std::cin, publisherId);
-    std::cout << "ID языка: ";
-    std::getline(std::cin, languageId);
-    std::cout << "Год: ";
-    std::getline(std::cin, year);
-    std::cout << "Страниц: ";
-    std::getline(std::cin, pages);
-    std::cout << "Количество экземпляров: ";
-    std::getline(std::cin, copies);
-
-    const char* selectQuery =
-        "SELECT book_id FROM books "
-        "WHERE title = $1 "
-        "  AND author_id = $2::int "
-        "  AND genre_id = $3::int "
-        "  AND publisher_id = $4::int "
-        "  AND language_id = $5::int "
-        "  AND year = $6::int "
-        "  AND pages = $7::int;";
-
-    const char* selectParams[7] = {
+    prompt("Название: ");
+    std::getline(in(), title);
+    prompt("ID автора: ");
+    std::getline(in(), authorId);
+    prompt("ID жанра: ");
+    std::getline(in(), genreId);
+    prompt("ID издателя: ");
+    std::getline(in(), publisherId);
+    prompt("ID языка: ");
+    std::getline(in(), languageId);
+    prompt("Год: ");
+    std::getline(in(), year);
+    prompt("Страниц: ");
+    std::getline(in(), pages);
+    prompt("Количество экземпляров: ");
+    std::getline(in(), copies);
+
+    // Добавление или пополнение — один оператор: одновременное добавление
+    // той же книги с двух мест не создаёт дубликат
+    const char* params[8] = {
         title.c_str(), authorId.c_str(), genreId.c_str(),
-        publisherId.c_str(), languageId.c_str(), year.c_str(), pages.c_str()
+        publisherId.c_str(), languageId.c_str(), year.c_str(),
+        pages.c_str(), copies.c_str()
     };
 
-    PGresult* res = PQexecParams(conn, selectQuery, 7, nullptr,
-        selectParams, nullptr, nullptr, 0);
+    PGresult* res = execPrepared(conn, "book_upsert", 8, params);
 
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-        std::cerr << "Ошибка при проверке существующей книги: "
+    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) == 0) {
+        err() << "Ошибка при добавлении книги: "
             << PQresultErrorMessage(res) << std::endl;
         PQclear(res);
         return;
     }
 
-    if (PQntuples(res) > 0) {
-        std::string bookId = PQgetvalue(res, 0, 0);
+    std::string bookId = PQgetvalue(res, 0, 0);
+    bool inserted = (PQgetvalue(res, 0, 1)[0] == 't');
+    PQclear(res);
+
+    if (inserted)
+        out() << "Книга добавлена, ID: " << bookId << "\n";
+    else
+        out() << "Книга уже есть в каталоге (ID " << bookId
+              << "), добавлено экземпляров: " << copies << "\n";
+}
+
+// Строка результата loan_issue: код результата и ID новой выдачи
+static LoanStatus readLoanRow(const PGresult* res, int& loanId) {
+    int32_t status;
+    std::optional<int32_t> id;
+    if (!readRow(res, 0, status, id) || status < 0 || status > 3) return LoanStatus::Error;
+    if (id) loanId = *id;
+    return static_cast<LoanStatus>(status);
+}
+
+LoanStatus issueLoan(PGconn* conn, int bookId, int readerId,
+    const std::string& date, int& loanId) {
+    PGresult* res = execPrepared(conn, "loan_issue",
+        QueryParams().add(bookId).add(readerId).add(date));
+
+    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) == 0) {
+        err() << "Ошибка при выдаче книги: "
+            << PQresultErrorMessage(res) << std::endl;
         PQclear(res);
+        return LoanStatus::Error;
+    }
 
-        const char* updateQuery =
-            "UPDATE books "
-            "SET copies_total = copies_total + $1::int, "
-            "    copies_available = copies_available + $1::int "
-            "WHERE book_id = $2::int;";
+    LoanStatus status = readLoanRow(res, loanId);
+    PQclear(res);
+    return status;
+}
 
-        const char* updateParams[2] = { copies.c_str(), bookId.c_str() };
-        execAndPrint(conn, updateQuery, 2, updateParams);
+static void readLoanResult(PGresult* res, LoanResult& result, long long& bytes) {
+    ExecStatusType status = PQresultStatus(res);
+    if (status == PGRES_TUPLES_OK && PQntuples(res) > 0) {
+        result.status = readLoanRow(res, result.loanId);
+        bytes += rowBytes(res);
     }
-    else {
-        PQclear(res);
+    else if (status != PGRES_TUPLES_OK) {
+        result.error = PQresultErrorMessage(res);
+    }
+}
 
-        const char* insertQuery =
-            "INSERT INTO books (title, author_id, genre_id, publisher_id, language_id, "
-            "                    year, pages, copies_total, copies_available) "
-            "VALUES ($1, $2::int, $3::int, $4::int, $5::int, $6::int, $7::int, "
-            "        $8::int, $8::int);";
+std::vector<LoanResult> issueLoans(PGconn* conn, const std::vector<LoanRequest>& requests) {
+    std::vector<LoanResult> results(requests.size(), { LoanStatus::Error, 0, "" });
+    if (requests.empty()) return results;
 
-        const char* insertParams[8] = {
-            title.c_str(), authorId.c_str(), genreId.c_str(),
-            publisherId.c_str(), languageId.c_str(), year.c_str(),
-            pages.c_str(), copies.c_str()
-        };
+    auto params = [&requests](size_t i) {
+        const LoanRequest& r = requests[i];
+        QueryParams p;
+        p.add(r.bookId).add(r.readerId).add(r.date);
+        return p;
+    };
 
-        execAndPrint(conn, insertQuery, 8, insertParams);
+    auto start = MetricsClock::now();
+    long long bytes = 0;
+    PipelineProgress progress = runPipeline(conn, requests.size(),
+        [&](size_t i) {
+            QueryParams p = params(i);
+            return PQsendQueryPrepared(conn, "loan_issue", p.size(), p.values(),
+                p.lengths(), p.formats(), BINARY_FORMAT) == 1;
+        },
+        [&](size_t i, PGresult* res) {
+            readLoanResult(res, results[i], bytes);
+            PQclear(res);
+        });
+    recordQuery("loan_issue_pipeline", MetricsClock::now() - start,
+        static_cast<long long>(progress.queued), bytes);
+
+    for (size_t i = progress.completed; i < requests.size(); ++i) {
+        LoanResult& result = results[i];
+        if (i < progress.queued) {
+            // Ответ потерян вместе с соединением: выдача могла состояться,
+            // повторять её нельзя
+            result.status = LoanStatus::Error;
+            result.error = "соединение потеряно, выдача могла быть выполнена";
+            continue;
+        }
+        // До сервера не дошла — выдаётся отдельным запросом
+        PGresult* res = execPrepared(conn, "loan_issue", params(i));
+        if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) == 0) {
+            result.error = "пустой ответ";
+        }
+        readLoanResult(res, result, bytes);
+        PQclear(res);
     }
+    return results;
 }
 
 void loanBook(PGconn* conn) {
-    std::string bookId, readerId, date;
-    std::cout << "ID книги: ";
-    std::getline(std::cin, bookId);
-    if (!isNumber(bookId) || !bookExists(conn, bookId)) return;
+    std::string input, date;
+    int32_t bookId, readerId;
+    prompt("ID книги: ");
+    std::getline(in(), input);
+    if (!isNumber(input) || !parseInt32(input, bookId)) {
+        err() << "Некорректный ID книги.\n";
+        return;
+    }
 
-    std::cout << "ID читателя: ";
-    std::getline(std::cin, readerId);
-    if (!isNumber(readerId) || !readerExists(conn, readerId)) return;
+    prompt("ID читателя: ");
+    std::getline(in(), input);
+    if (!isNumber(input) || !parseInt32(input, readerId)) {
+        err() << "Некорректный ID читателя.\n";
+        return;
+    }
 
-    std::cout << "Дата выдачи (YYYY-MM-DD): ";
-    std::getline(std::cin, date);
+    prompt("Дата выдачи (YYYY-MM-DD): ");
+    std::getline(in(), date);
+
+    int loanId = 0;
+    switch (issueLoan(conn, bookId, readerId, date, loanId)) {
+    case LoanStatus::Ok:
+        out() << "Книга выдана, ID выдачи: " << loanId << "\n";
+        break;
+    case LoanStatus::NoBook:
+        err() << "Книга с таким ID не найдена.\n";
+        break;
+    case LoanStatus::NoReader:
+        err() << "Читатель с таким ID не найден.\n";
+        break;
+    case LoanStatus::NoCopies:
+        err() << "Нельзя выдать книгу: нет доступных экземпляров "
+                 "(читателя можно поставить в очередь ожидания).\n";
+        break;
+    case LoanStatus::Error:
+        break;
+    }
+}
 
-    const char* checkQuery =
-        "SELECT copies_available FROM books WHERE book_id = $1::int;";
-    const char* checkParams[1] = { bookId.c_str() };
-    PGresult* res = PQexecParams(conn, checkQuery, 1, nullptr,
-        checkParams, nullptr, nullptr, 0);
+std::vector<ReturnResult> returnLoans(PGconn* conn,
+    const std::vector<int>& loanIds, const std::string& date) {
+    std::vector<ReturnResult> results;
+    if (loanIds.empty()) return results;
 
-    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) == 0) {
-        std::cerr << "Ошибка при проверке книги.\n";
+    PGresult* res = execPrepared(conn, "loans_return",
+        QueryParams().add(loanIds).add(date));
+
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        err() << "Ошибка при возврате книг: "
+            << PQresultErrorMessage(res) << std::endl;
         PQclear(res);
-        return;
+        return results;
     }
 
-    int available = std::stoi(PQgetvalue(res, 0, 0));
+    int rows = PQntuples(res);
+    results.reserve(rows);
+    for (int i = 0; i < rows; ++i) {
+        ReturnResult r = { 0, false, 0 };
+        std::optional<int32_t> holdLoanId;
+        readRow(res, i, r.loanId, r.returned, holdLoanId);
+        if (holdLoanId) r.holdLoanId = *holdLoanId;
+        results.push_back(r);
+    }
     PQclear(res);
+    return results;
+}
 
-    if (available <= 0) {
-        std::cout << "Нельзя выдать книгу: нет доступных экземпляров.\n";
+void returnBook(PGconn* conn) {
+    std::string input, date;
+    int32_t loanId;
+    prompt("ID выдачи: ");
+    std::getline(in(), input);
+    if (!isNumber(input) || !parseInt32(input, loanId)) {
+        err() << "Некорректный ID выдачи.\n";
         return;
     }
 
-    const char* insertQuery =
-        "INSERT INTO loans (book_id, reader_id, loan_date) "
-        "VALUES ($1::int, $2::int, $3::date);";
-    const char* insertParams[3] = { bookId.c_str(), readerId.c_str(), date.c_str() };
-    execAndPrint(conn, insertQuery, 3, insertParams);
+    prompt("Дата возврата (YYYY-MM-DD): ");
+    std::getline(in(), date);
+
+    std::vector<ReturnResult> results = returnLoans(conn, { loanId }, date);
+    if (results.empty()) return;
 
-    const char* updateQuery =
-        "UPDATE books "
-        "SET copies_available = copies_available - 1 "
-        "WHERE book_id = $1::int;";
-    const char* updateParams[1] = { bookId.c_str() };
-    execAndPrint(conn, updateQuery, 1, updateParams);
+    if (!results[0].returned)
+        err() << "Нет активной выдачи с таким ID (возможно, уже возвращена).\n";
+    else if (results[0].holdLoanId != 0)
+        out() << "Книга возвращена и выдана по очереди ожидания, ID выдачи: "
+              << results[0].holdLoanId << "\n";
+    else
+        out() << "Операция выполнена успешно.\n";
 }
 
-void returnBook(PGconn* conn) {
-    std::string loanId, date;
-    std::cout << "ID выдачи: ";
-    std::getline(std::cin, loanId);
-    if (!isNumber(loanId)) {
-        std::cout << "Некорректный ID выдачи.\n";
+void returnBooksBatch(PGconn* conn) {
+    std::string line, date;
+    prompt("ID выдач (через пробел или запятую): ");
+    std::getline(in(), line);
+
+    std::vector<int> loanIds;
+    std::string current;
+    for (char c : line + " ") {
+        if (c == ' ' || c == ',' || c == '\t') {
+            if (current.empty()) continue;
+            int32_t id;
+            if (!isNumber(current) || !parseInt32(current, id)) {
+                err() << "Некорректный ID выдачи: " << current << "\n";
+                return;
+            }
+            loanIds.push_back(id);
+            current.clear();
+        }
+        else {
+            current += c;
+        }
+    }
+    if (loanIds.empty()) {
+        err() << "Не введено ни одного ID.\n";
         return;
     }
 
-    std::cout << "Дата возврата (YYYY-MM-DD): ";
-    std::getline(std::cin, date);
+    prompt("Дата возврата (YYYY-MM-DD): ");
+    std::getline(in(), date);
+
+    std::vector<ReturnResult> results = returnLoans(conn, loanIds, date);
+    int returned = 0;
+    for (const auto& r : results) {
+        if (r.returned) {
+            ++returned;
+            out() << "Выдача " << r.loanId << ": возвращена";
+            if (r.holdLoanId != 0) out() << ", по очереди выдана как " << r.holdLoanId;
+            out() << "\n";
+        }
+        else {
+            err() << "Выдача " << r.loanId << ": нет активной выдачи\n";
+        }
+    }
+    if (!results.empty())
+        out() << "Возвращено " << returned << " из " << results.size() << ".\n";
+}
 
-    const char* querySelect =
-        "SELECT book_id FROM loans WHERE loan_id = $1::int AND return_date IS NULL;";
-    const char* paramsSel[1] = { loanId.c_str() };
-    PGresult* res = PQexecParams(conn, querySelect, 1, nullptr,
-        paramsSel, nullptr, nullptr, 0);
+HoldStatus placeHold(PGconn* conn, int bookId, int readerId, int& holdId, int& position) {
+    PGresult* res = execPrepared(conn, "hold_place",
+        QueryParams().add(bookId).add(readerId));
 
     if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) == 0) {
-        std::cout << "Нет активной выдачи с таким ID (возможно, уже возвращена).\n";
+        err() << "Ошибка при постановке в очередь: "
+            << PQresultErrorMessage(res) << std::endl;
         PQclear(res);
-        return;
+        return HoldStatus::Error;
     }
 
-    std::string bookId = PQgetvalue(res, 0, 0);
+    int32_t status;
+    std::optional<int32_t> id;
+    int32_t pos = 0;
+    bool ok = readRow(res, 0, status, id, pos) && status >= 0 && status <= 4;
     PQclear(res);
-
-    const char* query1 =
-        "UPDATE loans SET return_date = $1::date WHERE loan_id = $2::int;";
-    const char* params1[2] = { date.c_str(), loanId.c_str() };
-    execAndPrint(conn, query1, 2, params1);
-
-    const char* query2 =
-        "UPDATE books "
-        "SET copies_available = LEAST(copies_available + 1, copies_total) "
-        "WHERE book_id = $1::int;";
-    const char* params2[1] = { bookId.c_str() };
-    execAndPrint(conn, query2, 1, params2);
+    if (!ok) return HoldStatus::Error;
+    if (id) holdId = *id;
+    position = pos;
+    return static_cast<HoldStatus>(status);
 }
 
-void deleteBook(PGconn* conn) {
-    std::string bookId, countStr;
-    std::cout << "ID книги: ";
-    std::getline(std::cin, bookId);
-    if (!isNumber(bookId) || !bookExists(conn, bookId)) return;
-
-    std::cout << "Сколько экземпляров удалить: ";
-    std::getline(std::cin, countStr);
-
-    int toDelete = 0;
-    try {
-        toDelete = std::stoi(countStr);
+void holdBook(PGconn* conn) {
+    std::string input;
+    int32_t bookId, readerId;
+    prompt("ID книги: ");
+    std::getline(in(), input);
+    if (!isNumber(input) || !parseInt32(input, bookId)) {
+        err() << "Некорректный ID книги.\n";
+        return;
     }
-    catch (...) {
-        std::cout << "Некорректное число.\n";
+
+    prompt("ID читателя: ");
+    std::getline(in(), input);
+    if (!isNumber(input) || !parseInt32(input, readerId)) {
+        err() << "Некорректный ID читателя.\n";
         return;
     }
 
-    if (toDelete <= 0) {
-        std::cout << "Количество для удаления должно быть положительным.\n";
+    int holdId = 0;
+    int position = 0;
+    switch (placeHold(conn, bookId, readerId, holdId, position)) {
+    case HoldStatus::Ok:
+        out() << "Читатель поставлен в очередь, ID заявки: " << holdId
+              << ", место в очереди: " << position << "\n";
+        break;
+    case HoldStatus::NoBook:
+        err() << "Книга с таким ID не найдена.\n";
+        break;
+    case HoldStatus::NoReader:
+        err() << "Читатель с таким ID не найден.\n";
+        break;
+    case HoldStatus::Available:
+        err() << "Есть свободные экземпляры, книгу можно выдать сразу.\n";
+        break;
+    case HoldStatus::AlreadyWaiting:
+        err() << "Читатель уже стоит в очереди на эту книгу.\n";
+        break;
+    case HoldStatus::Error:
+        break;
+    }
+}
+
+void cancelHold(PGconn* conn) {
+    std::string input;
+    int32_t holdId;
+    prompt("ID заявки: ");
+    std::getline(in(), input);
+    if (!isNumber(input) || !parseInt32(input, holdId)) {
+        err() << "Некорректный ID заявки.\n";
         return;
     }
 
-    const char* activeQuery =
-        "SELECT COUNT(*) FROM loans "
-        "WHERE book_id = $1::int AND return_date IS NULL;";
-    const char* activeParams[1] = { bookId.c_str() };
-    PGresult* resActive = PQexecParams(conn, activeQuery, 1, nullptr,
-        activeParams, nullptr, nullptr, 0);
+    PGresult* res = execPrepared(conn, "hold_cancel", QueryParams().add(holdId));
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        err() << "Ошибка при отмене заявки: "
+            << PQresultErrorMessage(res) << std::endl;
+    }
+    else if (PQntuples(res) == 0) {
+        err() << "Нет ожидающей заявки с таким ID.\n";
+    }
+    else {
+        out() << "Заявка отменена.\n";
+    }
+    PQclear(res);
+}
 
-    if (PQresultStatus(resActive) != PGRES_TUPLES_OK) {
-        std::cerr << "Ошибка при проверке активных выдач: "
-            << PQresultErrorMessage(resActive) << std::endl;
-        PQclear(resActive);
+void bookHolds(PGconn* conn) {
+    std::string input;
+    int32_t bookId;
+    prompt("ID книги: ");
+    std::getline(in(), input);
+    if (!isNumber(input) || !parseInt32(input, bookId)) {
+        err() << "Некорректный ID книги.\n";
         return;
     }
 
-    int activeCount = std::stoi(PQgetvalue(resActive, 0, 0));
-    PQclear(resActive);
+    // Проверка книги и её очередь — за один обмен с сервером
+    QueryParams params;
+    params.add(bookId);
+    bool exists = false;
+    execPipelined(conn, {
+            { "book_exists", params, BINARY_FORMAT },
+            { "book_holds", params, TEXT_FORMAT },
+        },
+        [&exists](size_t i, PGresult* res) {
+            if (i == 0) {
+                exists = (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) > 0);
+                if (!exists) err() << "Книга с таким ID не найдена.\n";
+            }
+            else if (exists) {
+                printResult(res);
+            }
+        });
+}
 
-    const char* infoQuery =
-        "SELECT copies_total, copies_available "
-        "FROM books WHERE book_id = $1::int;";
-    PGresult* resInfo = PQexecParams(conn, infoQuery, 1, nullptr,
-        activeParams, nullptr, nullptr, 0);
+RemoveStatus removeCopies(PGconn* conn, int bookId, int count, int& total, int& available) {
+    PGresult* res = execPrepared(conn, "book_remove_copies",
+        QueryParams().add(bookId).add(count));
 
-    if (PQresultStatus(resInfo) != PGRES_TUPLES_OK || PQntuples(resInfo) == 0) {
-        std::cerr << "Книга с таким ID не найдена.\n";
-        PQclear(resInfo);
-        return;
+    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) == 0) {
+        err() << "Ошибка при удалении экземпляров: "
+            << PQresultErrorMessage(res) << std::endl;
+        PQclear(res);
+        return RemoveStatus::Error;
     }
 
-    int total = std::stoi(PQgetvalue(resInfo, 0, 0));
-    int available = std::stoi(PQgetvalue(resInfo, 0, 1));
-    PQclear(resInfo);
+    int32_t status;
+    std::optional<int32_t> newTotal, newAvailable;
+    bool ok = readRow(res, 0, status, newTotal, newAvailable) && status >= 0 && status <= 3;
+    PQclear(res);
+    if (!ok) return RemoveStatus::Error;
+    if (newTotal) total = *newTotal;
+    if (newAvailable) available = *newAvailable;
+    return static_cast<RemoveStatus>(status);
+}
 
-    if (toDelete > available) {
-        std::cout << "Нельзя удалить больше экземпляров, чем сейчас свободно.\n";
+void deleteBook(PGconn* conn) {
+    std::string input, countStr;
+    int32_t bookId;
+    prompt("ID книги: ");
+    std::getline(in(), input);
+    if (!isNumber(input) || !parseInt32(input, bookId) || !bookExists(conn, input)) return;
+
+    prompt("Сколько экземпляров удалить: ");
+    std::getline(in(), countStr);
+
+    int32_t toDelete = 0;
+    if (!parseInt32(countStr, toDelete)) {
+        err() << "Некорректное число.\n";
         return;
     }
 
-    int newTotal = total - toDelete;
-    int newAvailable = available - toDelete;
-
-    if (newTotal < activeCount) {
-        std::cout << "Нельзя удалить столько экземпляров: останется меньше, чем активных выдач.\n";
+    if (toDelete <= 0) {
+        err() << "Количество для удаления должно быть положительным.\n";
         return;
     }
 
-    if (newTotal <= 0) {
-        const char* delQuery =
-            "DELETE FROM books WHERE book_id = $1::int;";
-        const char* delParams[1] = { bookId.c_str() };
-        execAndPrint(conn, delQuery, 1, delParams);
+    int total = 0;
+    int available = 0;
+    switch (removeCopies(conn, bookId, toDelete, total, available)) {
+    case RemoveStatus::Ok:
+        out() << "Экземпляры списаны. Осталось: " << total
+              << ", свободно: " << available << "\n";
+        break;
+    case RemoveStatus::Deleted:
+        out() << "Списаны все экземпляры, книга удалена.\n";
+        break;
+    case RemoveStatus::NoBook:
+        err() << "Книга с таким ID не найдена.\n";
+        break;
+    case RemoveStatus::NotFree:
+        err() << "Нельзя удалить больше экземпляров, чем сейчас свободно.\n";
+        break;
+    case RemoveStatus::Error:
+        break;
+    }
+}
+
+// Сравнение с числом как диапазон фильтра: «< v» — до v - 1, «> v» — от v + 1
+static void compareRange(const std::string& op, int value,
+    std::optional<int>& from, std::optional<int>& to) {
+    if (op == "<") {
+        to = value;
+        if (value > std::numeric_limits<int>::min()) to = value - 1;
+        else from = value + 1;  // меньше минимального int — пустой диапазон
+    }
+    else if (op == ">") {
+        from = value;
+        if (value < std::numeric_limits<int>::max()) from = value + 1;
+        else to = value - 1;  // больше максимального int — пустой диапазон
     }
     else {
-        const char* updQuery =
-            "UPDATE books "
-            "SET copies_total = $1::int, copies_available = $2::int "
-            "WHERE book_id = $3::int;";
-        std::string newTotalStr = std::to_string(newTotal);
-        std::string newAvailStr = std::to_string(newAvailable);
-        const char* updParams[3] = {
-            newTotalStr.c_str(), newAvailStr.c_str(), bookId.c_str()
-        };
-        execAndPrint(conn, updQuery, 3, updParams);
+        from = value;
+        to = value;
     }
 }
 
+// Справочник по ID или части названия, как ID для фильтра
+static bool resolveFilterId(PGconn* conn, const std::string& tableName,
+    const std::string& input, const std::string& description, std::optional<int>& value) {
+    std::string id;
+    int32_t v;
+    if (!resolveIdByIdOrName(conn, tableName, input, description, id) || !parseInt32(id, v)) {
+        return false;
+    }
+    value = v;
+    return true;
+}
+
 void booksByYear(PGconn* conn) {
     std::string op, year;
-    std::cout << "Введите оператор (<, >, =): ";
-    std::getline(std::cin, op);
+    prompt("Введите оператор (<, >, =): ");
+    std::getline(in(), op);
     if (op != "<" && op != ">" && op != "=") {
-        std::cout << "Некорректный оператор.\n";
+        err() << "Некорректный оператор.\n";
         return;
     }
 
-    std::cout << "Введите год: ";
-    std::getline(std::cin, year);
-    if (!isNumber(year)) {
-        std::cout << "Год должен быть числом.\n";
+    prompt("Введите год: ");
+    std::getline(in(), year);
+    int32_t value;
+    if (!isNumber(year) || !parseInt32(year, value)) {
+        err() << "Год должен быть числом.\n";
         return;
     }
 
-    std::string query =
-        "SELECT b.book_id AS id, b.title, a.name AS author, g.name AS genre, "
-        "       p.name AS publisher, l.name AS language, b.year, b.pages, "
-        "       b.copies_total, b.copies_available, "
-        "       CASE WHEN b.copies_available > 0 "
-        "            THEN 'Есть в наличии' ELSE 'Нет в наличии' END AS status "
-        "FROM books b "
-        "JOIN authors a    ON b.author_id = a.author_id "
-        "JOIN genres g     ON b.genre_id = g.genre_id "
-        "JOIN publishers p ON b.publisher_id = p.publisher_id "
-        "JOIN languages l  ON b.language_id = l.language_id "
-        "WHERE b.year " + op + " $1::int "
-        "ORDER BY b.year, b.book_id;";
-
-    const char* params[1] = { year.c_str() };
-    execAndPrint(conn, query.c_str(), 1, params);
+    BookFilter filter;
+    compareRange(op, value, filter.yearFrom, filter.yearTo);
+    browseBooks(conn, filter);
 }
 
 void booksByPublisher(PGconn* conn) {
     std::string input;
-    std::cout << "Введите издательство (ID или часть названия): ";
+    prompt("Введите издательство (ID или часть названия): ");
 
-    std::getline(std::cin, input);
+    std::getline(in(), input);
 
-    std::string publisherId;
-    if (!resolveIdByIdOrName(conn,
+    BookFilter filter;
+    if (!resolveFilterId(conn,
         "publishers",
-        "publisher_id",
-        "name",
         input,
         "издательство",
-        publisherId)) {
+        filter.publisherId)) {
         return;
     }
 
-    const char* query =
-        "SELECT b.book_id AS id, b.title, a.name AS author, g.name AS genre, "
-        "       p.name AS publisher, l.name AS language, b.year, b.pages, "
-        "       b.copies_total, b.copies_available, "
-        "       CASE WHEN b.copies_available > 0 "
-        "            THEN 'Есть в наличии' ELSE 'Нет в наличии' END AS status "
-        "FROM books b "
-        "JOIN authors a    ON b.author_id = a.author_id "
-        "JOIN genres g     ON b.genre_id = g.genre_id "
-        "JOIN publishers p ON b.publisher_id = p.publisher_id "
-        "JOIN languages l  ON b.language_id = l.language_id "
-        "WHERE p.publisher_id = $1::int "
-        "ORDER BY b.book_id;";
-
-    const char* params[1] = { publisherId.c_str() };
-    execAndPrint(conn, query, 1, params);
+    browseBooks(conn, filter);
 }
 
 void booksByGenre(PGconn* conn) {
     std::string input;
-    std::cout << "Введите жанр (ID или часть названия): ";
+    prompt("Введите жанр (ID или часть названия): ");
 
-    std::getline(std::cin, input);
+    std::getline(in(), input);
 
-    std::string genreId;
-    if (!resolveIdByIdOrName(conn,
+    BookFilter filter;
+    if (!resolveFilterId(conn,
         "genres",
-        "genre_id",
-        "name",
         input,
         "жанр",
-        genreId)) {
+        filter.genreId)) {
         return;
     }
 
-    const char* query =
-        "SELECT b.book_id AS id, b.title, a.name AS author, g.name AS genre, "
-        "       p.name AS publisher, l.name AS language, b.year, b.pages, "
-        "       b.copies_total, b.copies_available, "
-        "       CASE WHEN b.copies_available > 0 "
-        "            THEN 'Есть в наличии' ELSE 'Нет в наличии' END AS status "
-        "FROM books b "
-        "JOIN authors a    ON b.author_id = a.author_id "
-        "JOIN genres g     ON b.genre_id = g.genre_id "
-        "JOIN publishers p ON b.publisher_id = p.publisher_id "
-        "JOIN languages l  ON b.language_id = l.language_id "
-        "WHERE g.genre_id = $1::int "
-        "ORDER BY b.book_id;";
-
-    const char* params[1] = { genreId.c_str() };
-    execAndPrint(conn, query, 1, params);
+    browseBooks(conn, filter);
 }
 
 void booksByPages(PGconn* conn) {
     std::string op, pages;
-    std::cout << "Введите оператор (<, >, =): ";
-    std::getline(std::cin, op);
+    prompt("Введите оператор (<, >, =): ");
+    std::getline(in(), op);
     if (op != "<" && op != ">" && op != "=") {
-        std::cout << "Некорректный оператор.\n";
+        err() << "Некорректный оператор.\n";
         return;
     }
 
-    std::cout << "Введите количество страниц: ";
-    std::getline(std::cin, pages);
-    if (!isNumber(pages)) {
-        std::cout << "Количество страниц должно быть числом.\n";
+    prompt("Введите количество страниц: ");
+    std::getline(in(), pages);
+    int32_t value;
+    if (!isNumber(pages) || !parseInt32(pages, value)) {
+        err() << "Количество страниц должно быть числом.\n";
         return;
     }
 
-    std::string query =
-        "SELECT b.book_id AS id, b.title, a.name AS author, g.name AS genre, "
-        "       p.name AS publisher, l.name AS language, b.year, b.pages, "
-        "       b.copies_total, b.copies_available, "
-        "       CASE WHEN b.copies_available > 0 "
-        "            THEN 'Есть в наличии' ELSE 'Нет в наличии' END AS status "
-        "FROM books b "
-        "JOIN authors a    ON b.author_id = a.author_id "
-        "JOIN genres g     ON b.genre_id = g.genre_id "
-        "JOIN publishers p ON b.publisher_id = p.publisher_id "
-        "JOIN languages l  ON b.language_id = l.language_id "
-        "WHERE b.pages " + op + " $1::int "
-        "ORDER BY b.pages, b.book_id;";
-
-    const char* params[1] = { pages.c_str() };
-    execAndPrint(conn, query.c_str(), 1, params);
+    BookFilter filter;
+    compareRange(op, value, filter.pagesFrom, filter.pagesTo);
+    browseBooks(conn, filter);
 }
 
 void booksByAuthor(PGconn* conn) {
     std::string input;
-    std::cout << "Введите автора (ID или часть имени): ";
+    prompt("Введите автора (ID или часть имени): ");
 
-    std::getline(std::cin, input);
+    std::getline(in(), input);
 
-    std::string authorId;
-    if (!resolveIdByIdOrName(conn,
+    BookFilter filter;
+    if (!resolveFilterId(conn,
         "authors",
-        "author_id",
-        "name",
         input,
         "автор",
-        authorId)) {
+        filter.authorId)) {
         return;
     }
 
-    const char* query =
-        "SELECT b.book_id AS id, b.title, a.name AS author, g.name AS genre, "
-        "       p.name AS publisher, l.name AS language, b.year, b.pages, "
-        "       b.copies_total, b.copies_available, "
-        "       CASE WHEN b.copies_available > 0 "
-        "            THEN 'Есть в наличии' ELSE 'Нет в наличии' END AS status "
-        "FROM books b "
-        "JOIN authors a    ON b.author_id = a.author_id "
-        "JOIN genres g     ON b.genre_id = g.genre_id "
-        "JOIN publishers p ON b.publisher_id = p.publisher_id "
-        "JOIN languages l  ON b.language_id = l.language_id "
-        "WHERE a.author_id = $1::int "
-        "ORDER BY b.book_id;";
-
-    const char* params[1] = { authorId.c_str() };
-    execAndPrint(conn, query, 1, params);
+    browseBooks(conn, filter);
 }
 
 void freeBooks(PGconn* conn) {
-    const char* query =
-        "SELECT b.book_id AS id, b.title, a.name AS author, g.name AS genre, "
-        "       p.name AS publisher, l.name AS language, b.year, b.pages, "
-        "       b.copies_total, b.copies_available, "
-        "       CASE WHEN b.copies_available > 0 "
-        "            THEN 'Есть в наличии' ELSE 'Нет в наличии' END AS status "
-        "FROM books b "
-        "JOIN authors a    ON b.author_id = a.author_id "
-        "JOIN genres g     ON b.genre_id = g.genre_id "
-        "JOIN publishers p ON b.publisher_id = p.publisher_id "
-        "JOIN languages l  ON b.language_id = l.language_id "
-        "WHERE b.copies_available > 0 "
-        "ORDER BY b.book_id;";
-    execAndPrint(conn, query, 0, nullptr);
+    BookFilter filter;
+    filter.availableOnly = true;
+    browseBooks(conn, filter);
+}
+
+// Необязательная граница диапазона: пустой ввод — без ограничения
+static bool readBound(const char* text, const char* error, std::optional<int>& value) {
+    std::string input;
+    prompt(text);
+    std::getline(in(), input);
+    if (input.empty()) return true;
+
+    int32_t v;
+    if (!parseInt32(input, v)) {
+        out() << error << "\n";
+        return false;
+    }
+    value = v;
+    return true;
+}
+
+// Необязательное условие по справочнику: пустой ввод — любое значение
+static bool readReference(PGconn* conn, const char* text, const std::string& tableName,
+    const std::string& description, std::optional<int>& value) {
+    std::string input;
+    prompt(text);
+    std::getline(in(), input);
+    return input.empty() || resolveFilterId(conn, tableName, input, description, value);
+}
+
+void filterBooks(PGconn* conn) {
+    BookFilter filter;
+    if (!readBound("Год от (Enter — без ограничения): ",
+            "Год должен быть числом.", filter.yearFrom) ||
+        !readBound("Год до: ", "Год должен быть числом.", filter.yearTo) ||
+        !readBound("Страниц от: ",
+            "Количество страниц должно быть числом.", filter.pagesFrom) ||
+        !readBound("Страниц до: ",
+            "Количество страниц должно быть числом.", filter.pagesTo) ||
+        !readReference(conn, "Автор (ID или часть имени, Enter — любой): ",
+            "authors", "автор", filter.authorId) ||
+        !readReference(conn, "Жанр: ", "genres", "жанр", filter.genreId) ||
+        !readReference(conn, "Издательство: ", "publishers", "издательство",
+            filter.publisherId) ||
+        !readReference(conn, "Язык: ", "languages", "язык", filter.languageId)) {
+        return;
+    }
+
+    std::string available;
+    prompt("Только свободные книги (да/нет): ");
+    std::getline(in(), available);
+    filter.availableOnly = (available == "да" || available == "д" || available == "yes" ||
+        available == "y");
+
+    browseBooks(conn, filter);
+}
+
+// Строка поиска как запрос tsquery: каждое слово ищется по префиксу, все
+// слова обязательны. Берутся только буквы и цифры, так что синтаксис
+// tsquery из ввода не попадает в запрос.
+static std::string prefixQuery(const std::string& input) {
+    std::string query, word;
+    auto flush = [&]() {
+        if (word.empty()) return;
+        if (!query.empty()) query += " & ";
+        query += word + ":*";
+        word.clear();
+    };
+    for (unsigned char c : input) {
+        // Байты UTF-8 старше ASCII — части букв кириллицы и т.п.
+        if (c >= 0x80 || std::isalnum(c)) word += static_cast<char>(c);
+        else flush();
+    }
+    flush();
+    return query;
+}
+
+void searchBooks(PGconn* conn) {
+    std::string input;
+    prompt("Слова из названия или имени автора: ");
+    std::getline(in(), input);
+
+    std::string query = prefixQuery(input);
+    if (query.empty()) {
+        err() << "Введите хотя бы одно слово.\n";
+        return;
+    }
+
+    browseListing(conn, "books_search", { query });
 }
 
 void listReaders(PGconn* conn) {
-    const char* query =
-        "SELECT r.reader_id AS id, r.full_name, r.phone, r.email, "
-        "       CASE WHEN EXISTS ("
-        "                SELECT 1 FROM loans l "
-        "                WHERE l.reader_id = r.reader_id "
-        "                  AND l.return_date IS NULL"
-        "            ) "
-        "            THEN 'Сейчас есть книги' "
-        "            ELSE 'Сейчас нет книг' "
-        "       END AS status "
-        "FROM readers r "
-        "ORDER BY r.reader_id;";
-    execAndPrint(conn, query, 0, nullptr);
+    browseListing(conn, "list_readers", {});
 }
 
 void readerLoans(PGconn* conn) {
     std::string readerId;
-    std::cout << "ID читателя: ";
-    std::getline(std::cin, readerId);
-    if (!isNumber(readerId) || !readerExists(conn, readerId)) return;
-
-    const char* query =
-        "SELECT l.loan_id AS loan, b.book_id AS book_id, b.title, "
-        "       a.name AS author, g.name AS genre, "
-        "       p.name AS publisher, l2.name AS language, "
-        "       b.year, b.pages, l.loan_date "
-        "FROM loans l "
-        "JOIN books b      ON l.book_id = b.book_id "
-        "JOIN authors a    ON b.author_id = a.author_id "
-        "JOIN genres g     ON b.genre_id = g.genre_id "
-        "JOIN publishers p ON b.publisher_id = p.publisher_id "
-        "JOIN languages l2 ON b.language_id = l2.language_id "
-        "WHERE l.reader_id = $1::int "
-        "  AND l.return_date IS NULL "
-        "ORDER BY l.loan_id;";
-
-    const char* params[1] = { readerId.c_str() };
-    execAndPrint(conn, query, 1, params);
+    prompt("ID читателя: ");
+    std::getline(in(), readerId);
+    int32_t id;
+    if (!isNumber(readerId)) return;
+    if (!parseInt32(readerId, id)) {
+        err() << "Читатель с таким ID не найден.\n";
+        return;
+    }
+
+    // Проверка читателя и его выдачи — за один обмен с сервером
+    QueryParams params;
+    params.add(id);
+    bool exists = false;
+    execPipelined(conn, {
+            { "reader_exists", params, BINARY_FORMAT },
+            { "reader_loans", params, TEXT_FORMAT },
+        },
+        [&exists](size_t i, PGresult* res) {
+            if (i == 0) {
+                exists = (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) > 0);
+                if (!exists) err() << "Читатель с таким ID не найден.\n";
+            }
+            else if (exists) {
+                printResult(res);
+            }
+        });
 }
 
 void addAuthor(PGconn* conn) {
     std::string name, country;
-    std::cout << "Имя автора: ";
-    std::getline(std::cin, name);
-    std::cout << "Страна (опционально): ";
-    std::getline(std::cin, country);
+    prompt("Имя автора: ");
+    std::getline(in(), name);
+    prompt("Страна (опционально): ");
+    std::getline(in(), country);
 
-    const char* query =
-        "INSERT INTO authors (name, country) VALUES ($1, $2);";
     const char* params[2] = { name.c_str(), country.c_str() };
-    execAndPrint(conn, query, 2, params);
+    execPreparedAndPrint(conn, "author_insert", 2, params);
 }
 
 void addGenre(PGconn* conn) {
     std::string name;
-    std::cout << "Название жанра: ";
-    std::getline(std::cin, name);
+    prompt("Название жанра: ");
+    std::getline(in(), name);
 
-    const char* query =
-        "INSERT INTO genres (name) VALUES ($1);";
     const char* params[1] = { name.c_str() };
-    execAndPrint(conn, query, 1, params);
+    execPreparedAndPrint(conn, "genre_insert", 1, params);
 }
 
 void addPublisher(PGconn* conn) {
     std::string name, city;
-    std::cout << "Название издательства: ";
-    std::getline(std::cin, name);
-    std::cout << "Город: ";
-    std::getline(std::cin, city);
+    prompt("Название издательства: ");
+    std::getline(in(), name);
+    prompt("Город: ");
+    std::getline(in(), city);
 
-    const char* query =
-        "INSERT INTO publishers (name, city) VALUES ($1, $2);";
     const char* params[2] = { name.c_str(), city.c_str() };
-    execAndPrint(conn, query, 2, params);
+    execPreparedAndPrint(conn, "publisher_insert", 2, params);
 }
 
 void addLanguage(PGconn* conn) {
     std::string name;
-    std::cout << "Название языка: ";
-    std::getline(std::cin, name);
+    prompt("Название языка: ");
+    std::getline(in(), name);
 
-    const char* query =
-        "INSERT INTO languages (name) VALUES ($1);";
     const char* params[1] = { name.c_str() };
-    execAndPrint(conn, query, 1, params);
+    execPreparedAndPrint(conn, "language_insert", 1, params);
 }
 
 void listReferenceData(PGconn* conn) {
-    std::cout << "\n===== АВТОРЫ =====\n";
-    const char* q1 =
-        "SELECT author_id AS id, name, country "
-        "FROM authors ORDER BY author_id;";
-    execAndPrint(conn, q1, 0, nullptr);
-
-    std::cout << "\n===== ЖАНРЫ =====\n";
-    const char* q2 =
-        "SELECT genre_id AS id, name "
-        "FROM genres ORDER BY genre_id;";
-    execAndPrint(conn, q2, 0, nullptr);
-
-    std::cout << "\n===== ИЗДАТЕЛЬСТВА =====\n";
-    const char* q3 =
-        "SELECT publisher_id AS id, name, city "
-        "FROM publishers ORDER BY publisher_id;";
-    execAndPrint(conn, q3, 0, nullptr);
-
-    std::cout << "\n===== ЯЗЫКИ =====\n";
-    const char* q4 =
-        "SELECT language_id AS id, name "
-        "FROM languages ORDER BY language_id;";
-    execAndPrint(conn, q4, 0, nullptr);
+    static const char* const SECTIONS[][2] = {
+        { "ref_authors",    "АВТОРЫ" },
+        { "ref_genres",     "ЖАНРЫ" },
+        { "ref_publishers", "ИЗДАТЕЛЬСТВА" },
+        { "ref_languages",  "ЯЗЫКИ" },
+    };
+
+    // Все четыре справочника запрашиваются сразу, таблицы выводятся
+    // по мере получения ответов
+    std::vector<PipelinedQuery> queries;
+    for (const auto& section : SECTIONS) {
+        queries.push_back({ section[0], QueryParams(), TEXT_FORMAT });
+    }
+    execPipelined(conn, queries, [](size_t i, PGresult* res) {
+        out() << "\n===== " << SECTIONS[i][1] << " =====\n";
+        printResult(res);
+    });
 }
@@ -1,12 +1,205 @@
 #pragma once
+#include "pgtypes.h"
 #include <libpq-fe.h>
+#include <functional>
+#include <iosfwd>
+#include <optional>
 #include <string>
+#include <vector>
+
+// Ввод и вывод операций идут через потоки сеанса текущего потока:
+// по умолчанию это консоль, в режиме сервиса и сценариев — данные клиента.
+// В err() пишутся ошибки и отказы операции (нет книги, некорректный ID и
+// т.п.); любая запись туда отмечает операцию сеанса как неуспешную.
+std::istream& in();
+std::ostream& out();
+std::ostream& err();
+
+// Была ли в текущем сеансе (SessionScope) ошибка или отказ
+bool operationFailed();
+
+// Подсказка для ввода; вне интерактивного сеанса не выводится
+void prompt(const char* text);
+
+// Подменяет потоки сеанса на время жизни объекта (неинтерактивный режим)
+class SessionScope {
+public:
+    SessionScope(std::istream& input, std::ostream& output, std::ostream& errors);
+    ~SessionScope();
+    SessionScope(const SessionScope&) = delete;
+    SessionScope& operator=(const SessionScope&) = delete;
+
+private:
+    std::istream* savedIn;
+    std::ostream* savedOut;
+    std::ostream* savedErr;
+    bool savedInteractive;
+    bool savedFailed;
+};
+
+// Подготовленный запрос: имя в сеансе, текст и число параметров
+struct PreparedStatement {
+    std::string name;
+    std::string sql;
+    int nParams;
+};
 
 // Базовые функции
 void checkConn(PGconn* conn);
 void printResult(PGresult* res);
 void execAndPrint(PGconn* conn, const char* query, int nParams, const char* const* params);
 
+// Результат, собранный на клиенте, чтобы напечатать его как таблицу запроса
+PGresult* makeTextResult(const std::vector<std::string>& columns,
+    const std::vector<std::vector<std::string>>& rows);
+
+// Пополнение каталога: новая книга добавляется, у совпавшей по
+// естественному ключу (все поля, кроме экземпляров; миграция 6)
+// увеличиваются оба счётчика экземпляров. Общее окончание INSERT для
+// addBook и загрузки каталога; inserted — была ли книга добавлена.
+#define BOOK_UPSERT_CONFLICT \
+    " ON CONFLICT (title, author_id, genre_id, publisher_id, language_id, year, pages) " \
+    "DO UPDATE SET copies_total = b.copies_total + EXCLUDED.copies_total, " \
+    "              copies_available = b.copies_available + EXCLUDED.copies_available " \
+    "RETURNING b.book_id, (b.xmax = 0) AS inserted"
+
+// Подготовленные запросы: готовятся один раз после подключения
+// и заново после переподключения
+const std::vector<PreparedStatement>& statementRegistry();
+bool prepareStatements(PGconn* conn);
+bool reconnect(PGconn* conn);
+PGresult* execPrepared(PGconn* conn, const std::string& name, int nParams, const char* const* params);
+// Типизированные параметры; результат по умолчанию в двоичном формате,
+// читается через readRow
+PGresult* execPrepared(PGconn* conn, const std::string& name,
+    const QueryParams& params, int resultFormat = BINARY_FORMAT);
+void execPreparedAndPrint(PGconn* conn, const std::string& name, int nParams, const char* const* params);
+
+// Запрос пакета независимых запросов
+struct PipelinedQuery {
+    std::string name;
+    QueryParams params;
+    int resultFormat;
+};
+
+// Пакет независимых запросов за один обмен с сервером: все запросы
+// отправляются сразу в конвейерном режиме libpq, каждый в своей неявной
+// транзакции. onResult вызывается для каждого результата по мере получения,
+// в порядке запросов; результат освобождается после вызова. Запросы, которые
+// не дошли до сервера или не найдены в сеансе, выполняются заново по одному;
+// отправленные, но оставшиеся без ответа, не повторяются и дают ошибку.
+void execPipelined(PGconn* conn, const std::vector<PipelinedQuery>& queries,
+    const std::function<void(size_t index, PGresult* res)>& onResult);
+
+// Потоковый вывод больших списков: строки печатаются по мере получения,
+// в памяти держится только выборка для ширины столбцов
+void execPreparedAndStream(PGconn* conn, const std::string& name, int nParams, const char* const* params);
+
+// Постраничный просмотр списков (keyset): страница задаётся ключом
+// сортировки последней показанной строки. Размер 0 — весь список потоком.
+void setPageSize(int size);
+int pageSize();
+void browseListing(PGconn* conn, const std::string& name,
+    const std::vector<std::string>& filterValues);
+
+// Составной фильтр книг: любое сочетание условий, незаданные не участвуют.
+// Диапазоны включают границы; у диапазона может быть задана одна граница.
+struct BookFilter {
+    std::optional<int> yearFrom;
+    std::optional<int> yearTo;
+    std::optional<int> pagesFrom;
+    std::optional<int> pagesTo;
+    std::optional<int> authorId;
+    std::optional<int> genreId;
+    std::optional<int> publisherId;
+    std::optional<int> languageId;
+    bool availableOnly = false;
+};
+
+// Постраничный список книг по фильтру одним запросом
+void browseBooks(PGconn* conn, const BookFilter& filter);
+
+// Запросы фильтра готовятся при первом использовании; для проверки планов —
+// формы с каждым условием по отдельности и со всеми условиями сразу
+std::vector<PreparedStatement> bookFilterStatements();
+
+// Параметры условий формы фильтра по имени её запроса: заданные в форме
+// условия берутся из sample. Для запросов не из фильтра — пустой список.
+std::vector<std::string> bookFilterParams(const std::string& statementName,
+    const BookFilter& sample);
+bool prepareStatement(PGconn* conn, const PreparedStatement& st);
+
+// Результат выдачи книги
+enum class LoanStatus {
+    Ok = 0,
+    NoBook = 1,
+    NoReader = 2,
+    NoCopies = 3,
+    Error = 4
+};
+
+// Выдача книги одним атомарным запросом, без диалога с пользователем
+LoanStatus issueLoan(PGconn* conn, int bookId, int readerId,
+    const std::string& date, int& loanId);
+
+// Выдача из пачки и её результат; error — текст ошибки запроса
+struct LoanRequest {
+    int bookId;
+    int readerId;
+    std::string date;
+};
+
+struct LoanResult {
+    LoanStatus status;
+    int loanId;
+    std::string error;
+};
+
+// Пачка выдач в конвейерном режиме libpq: запросы отправляются без ожидания
+// ответов, каждая выдача фиксируется отдельно. Выдачи, не дошедшие до
+// сервера, выполняются по одной; оставшиеся без ответа — ошибка.
+std::vector<LoanResult> issueLoans(PGconn* conn, const std::vector<LoanRequest>& requests);
+
+// Результат возврата одной выдачи из пачки; holdLoanId — выдача, которой
+// экземпляр передан первому в очереди ожидания (0, если очереди не было)
+struct ReturnResult {
+    int loanId;
+    bool returned;
+    int holdLoanId;
+};
+
+// Возврат пачки выдач одним запросом в одной транзакции
+std::vector<ReturnResult> returnLoans(PGconn* conn,
+    const std::vector<int>& loanIds, const std::string& date);
+
+// Результат постановки в очередь ожидания книги
+enum class HoldStatus {
+    Ok = 0,
+    NoBook = 1,
+    NoReader = 2,
+    Available = 3,
+    AlreadyWaiting = 4,
+    Error = 5
+};
+
+// Заявка в очередь ожидания книги без свободных экземпляров; position —
+// место заявки в очереди
+HoldStatus placeHold(PGconn* conn, int bookId, int readerId, int& holdId, int& position);
+
+// Результат списания экземпляров книги
+enum class RemoveStatus {
+    Ok = 0,
+    NoBook = 1,
+    NotFree = 2,
+    Deleted = 3,
+    Error = 4
+};
+
+// Списание count свободных экземпляров одним оператором; total и
+// available — экземпляры книги после списания. Если списаны все
+// экземпляры, книга удаляется.
+RemoveStatus removeCopies(PGconn* conn, int bookId, int count, int& total, int& available);
+
 // Основные операции с книгами/выдачами
 void listBooks(PGconn* conn);
 void listActiveLoans(PGconn* conn);
@@ -14,6 +207,10 @@ void addReader(PGconn* conn);
 void addBook(PGconn* conn);
 void loanBook(PGconn* conn);
 void returnBook(PGconn* conn);
+void returnBooksBatch(PGconn* conn);
+void holdBook(PGconn* conn);
+void cancelHold(PGconn* conn);
+void bookHolds(PGconn* conn);
 void deleteBook(PGconn* conn);
 
 // Фильтры по книгам
@@ -23,6 +220,8 @@ void booksByGenre(PGconn* conn);
 void booksByPages(PGconn* conn);
 void booksByAuthor(PGconn* conn);
 void freeBooks(PGconn* conn);
+void filterBooks(PGconn* conn);
+void searchBooks(PGconn* conn);
 
 // Читатели
 void listReaders(PGconn* conn);
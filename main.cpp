@@ -1,7 +1,25 @@
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <thread>
 #include <libpq-fe.h>
 #include "database.h"
+#include "analytics.h"
+#include "archive.h"
+#include "bulk.h"
+#include "commands.h"
+#include "metrics.h"
+#include "migrations.h"
+#include "pool.h"
+#include "refcache.h"
+#include "render.h"
+#include "script.h"
+#include "service.h"
 
 void showMainMenu() {
     std::cout << "===== МЕНЮ БИБЛИОТЕКИ =====\n";
@@ -10,6 +28,8 @@ void showMainMenu() {
     std::cout << "3. Читатели\n";
     std::cout << "4. Добавление справочной информации\n";
     std::cout << "5. Справочная информация (авторы, жанры, издательства, языки)\n";
+    std::cout << "6. Экспорт данных (CSV, JSON Lines)\n";
+    std::cout << "7. Статистика запросов\n";
     std::cout << "0. Выход\n";
     std::cout << "Выбор: ";
 }
@@ -21,6 +41,7 @@ void booksMenu(PGconn* conn) {
         std::cout << "2. Добавить книгу\n";
         std::cout << "3. Удалить книгу / экземпляры\n";
         std::cout << "4. Поиск и фильтры\n";
+        std::cout << "5. Импорт каталога из файла (CSV/TSV)\n";
         std::cout << "0. Назад\n";
         std::cout << "Выбор: ";
 
@@ -32,9 +53,9 @@ void booksMenu(PGconn* conn) {
         if (choice == 0) break;
 
         switch (choice) {
-        case 1: listBooks(conn);      break;
-        case 2: addBook(conn);        break;
-        case 3: deleteBook(conn);     break;
+        case 1: runOperation(conn, listBooks);      break;
+        case 2: runOperation(conn, addBook);        break;
+        case 3: runOperation(conn, deleteBook);     break;
         case 4: {
             while (true) {
                 std::cout << "\n===== ПОИСК И ФИЛЬТРЫ =====\n";
@@ -44,6 +65,8 @@ void booksMenu(PGconn* conn) {
                 std::cout << "4. Книги по количеству страниц\n";
                 std::cout << "5. Книги по автору\n";
                 std::cout << "6. Свободные книги\n";
+                std::cout << "7. Несколько условий сразу\n";
+                std::cout << "8. Поиск по названию и автору\n";
                 std::cout << "0. Назад\n";
                 std::cout << "Выбор: ";
 
@@ -54,18 +77,21 @@ void booksMenu(PGconn* conn) {
                 if (fChoice == 0) break;
 
                 switch (fChoice) {
-                case 1: booksByYear(conn);      break;
-                case 2: booksByPublisher(conn); break;
-                case 3: booksByGenre(conn);     break;
-                case 4: booksByPages(conn);     break;
-                case 5: booksByAuthor(conn);    break;
-                case 6: freeBooks(conn);        break;
+                case 1: runOperation(conn, booksByYear);      break;
+                case 2: runOperation(conn, booksByPublisher); break;
+                case 3: runOperation(conn, booksByGenre);     break;
+                case 4: runOperation(conn, booksByPages);     break;
+                case 5: runOperation(conn, booksByAuthor);    break;
+                case 6: runOperation(conn, freeBooks);        break;
+                case 7: runOperation(conn, filterBooks);      break;
+                case 8: runOperation(conn, searchBooks);      break;
                 default:
                     std::cout << "Неверный выбор.\n";
                 }
             }
             break;
         }
+        case 5: runOperation(conn, importBooks);    break;
         default:
             std::cout << "Неверный выбор.\n";
         }
@@ -78,6 +104,10 @@ void loansMenu(PGconn* conn) {
         std::cout << "1. Активные выдачи\n";
         std::cout << "2. Выдать книгу\n";
         std::cout << "3. Вернуть книгу\n";
+        std::cout << "4. Вернуть несколько книг\n";
+        std::cout << "5. Поставить в очередь на книгу\n";
+        std::cout << "6. Отменить заявку\n";
+        std::cout << "7. Очередь на книгу\n";
         std::cout << "0. Назад\n";
         std::cout << "Выбор: ";
 
@@ -89,9 +119,13 @@ void loansMenu(PGconn* conn) {
         if (choice == 0) break;
 
         switch (choice) {
-        case 1: listActiveLoans(conn); break;
-        case 2: loanBook(conn);        break;
-        case 3: returnBook(conn);      break;
+        case 1: runOperation(conn, listActiveLoans);  break;
+        case 2: runOperation(conn, loanBook);         break;
+        case 3: runOperation(conn, returnBook);       break;
+        case 4: runOperation(conn, returnBooksBatch); break;
+        case 5: runOperation(conn, holdBook);         break;
+        case 6: runOperation(conn, cancelHold);       break;
+        case 7: runOperation(conn, bookHolds);        break;
         default:
             std::cout << "Неверный выбор.\n";
         }
@@ -115,9 +149,9 @@ void readersMenu(PGconn* conn) {
         if (choice == 0) break;
 
         switch (choice) {
-        case 1: listReaders(conn);  break;
-        case 2: readerLoans(conn);  break;
-        case 3: addReader(conn);    break;
+        case 1: runOperation(conn, listReaders);  break;
+        case 2: runOperation(conn, readerLoans);  break;
+        case 3: runOperation(conn, addReader);    break;
         default:
             std::cout << "Неверный выбор.\n";
         }
@@ -142,22 +176,245 @@ void addReferenceMenu(PGconn* conn) {
         if (choice == 0) break;
 
         switch (choice) {
-        case 1: addAuthor(conn);     break;
-        case 2: addGenre(conn);      break;
-        case 3: addPublisher(conn);  break;
-        case 4: addLanguage(conn);   break;
+        case 1: runOperation(conn, addAuthor);     break;
+        case 2: runOperation(conn, addGenre);      break;
+        case 3: runOperation(conn, addPublisher);  break;
+        case 4: runOperation(conn, addLanguage);   break;
         default:
             std::cout << "Неверный выбор.\n";
         }
     }
 }
 
-int main() {
-    PGconn* conn = PQconnectdb(
-        "host=localhost port=5432 dbname=library user=postgres password=1234"
-    );
+void printUsage(const char* program) {
+    std::cout << "Использование:\n"
+        << "  " << program << "                    интерактивное меню\n"
+        << "  " << program << " --serve СОКЕТ [--workers N] [--pool N]\n"
+        << "                           сервис для всех рабочих мест\n"
+        << "  " << program << " --migrate          применить миграции схемы\n"
+        << "  " << program << " --check-plans [N]  проверить планы запросов на N книгах\n"
+        << "  " << program << " --script ФАЙЛ|- [--pipeline] [--batch N]\n"
+        << "                           операции из файла, по одной в строке\n"
+        << "  " << program << " --analytics [--threads N]\n"
+        << "                           отчёты по снимку данных в памяти\n"
+        << "  " << program << " --archive [--archive-days N] [--archive-batch N]\n"
+        << "                           перенести закрытые выдачи в архив\n"
+        << "  " << program << " КОМАНДА [АРГУМЕНТЫ]  одна операция (список: help)\n"
+        << "Общие параметры: --page-size N (0 — списки целиком)\n"
+        << "  --format ИМЯ             вывод результатов: table, compact, tsv,\n"
+        << "                           csv или jsonl (также LIBRARY_OUTPUT_FORMAT)\n"
+        << "  --metrics-file ФАЙЛ [--metrics-interval С]\n"
+        << "                           метрики запросов в формате Prometheus\n"
+        << "  --archive-interval С     фоновый перенос закрытых выдач в архив\n"
+        << "                           (в меню и режиме сервиса)\n"
+        << "Подключение: LIBRARY_DSN, файл LIBRARY_CONF или library.conf;\n"
+        << "  для отчётов — LIBRARY_REPORT_DSN, если задана (например, реплика)\n";
+}
+
+int main(int argc, char** argv) {
+    std::string connInfo = loadConnInfo();
+
+    ServiceOptions service;
+    service.workers = std::thread::hardware_concurrency();
+    if (service.workers == 0) service.workers = 4;
+    service.poolSize = 0;
+    bool migrateOnly = false;
+    if (const char* size = std::getenv("LIBRARY_PAGE_SIZE")) setPageSize(std::atoi(size));
+    if (const char* name = std::getenv("LIBRARY_OUTPUT_FORMAT")) {
+        OutputFormat format;
+        if (parseOutputFormat(name, format)) setOutputFormat(format);
+        else std::cerr << "Неизвестный формат вывода в LIBRARY_OUTPUT_FORMAT: " << name << std::endl;
+    }
+    int checkPlansBooks = 0;
+    std::string metricsFile;
+    int metricsInterval = 15;
+    std::string scriptPath;
+    ScriptOptions script;
+    bool pageSizeSet = (std::getenv("LIBRARY_PAGE_SIZE") != nullptr);
+    std::string commandLine;
+    bool analytics = false;
+    AnalyticsOptions analyticsOpts;
+    bool archiveOnly = false;
+    ArchiveOptions archiveOpts;
+    int archiveInterval = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (arg == "--serve" && hasValue) {
+            service.socketPath = argv[++i];
+        }
+        else if (arg == "--workers" && hasValue) {
+            service.workers = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--pool" && hasValue) {
+            service.poolSize = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--page-size" && hasValue) {
+            setPageSize(std::atoi(argv[++i]));
+            pageSizeSet = true;
+        }
+        else if (arg == "--format" && hasValue) {
+            OutputFormat format;
+            if (!parseOutputFormat(argv[++i], format)) {
+                std::cerr << "Неизвестный формат вывода: " << argv[i] << std::endl;
+                return 1;
+            }
+            setOutputFormat(format);
+        }
+        else if (arg == "--script" && hasValue) {
+            scriptPath = argv[++i];
+        }
+        else if (arg == "--pipeline") {
+            script.pipeline = true;
+        }
+        else if (arg == "--batch" && hasValue) {
+            script.batchSize = std::strtoul(argv[++i], nullptr, 10);
+            if (script.batchSize == 0) script.batchSize = 1;
+        }
+        else if (arg == "--analytics") {
+            analytics = true;
+        }
+        else if (arg == "--threads" && hasValue) {
+            analyticsOpts.threads = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "help") {
+            printCommandHelp(std::cout);
+            return 0;
+        }
+        else if (findCommand(arg) != nullptr) {
+            // Остаток командной строки — одна операция с аргументами
+            for (; i < argc; ++i) {
+                std::string word = argv[i];
+                commandLine += " \"";
+                for (char c : word) {
+                    if (c == '"' || c == '\\') commandLine += '\\';
+                    commandLine += c;
+                }
+                commandLine += '"';
+            }
+        }
+        else if (arg == "--metrics-file" && hasValue) {
+            metricsFile = argv[++i];
+        }
+        else if (arg == "--metrics-interval" && hasValue) {
+            metricsInterval = std::atoi(argv[++i]);
+        }
+        else if (arg == "--archive") {
+            archiveOnly = true;
+        }
+        else if (arg == "--archive-days" && hasValue) {
+            archiveOpts.keepDays = std::max(0, std::atoi(argv[++i]));
+        }
+        else if (arg == "--archive-batch" && hasValue) {
+            archiveOpts.batchSize = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--archive-interval" && hasValue) {
+            archiveInterval = std::atoi(argv[++i]);
+        }
+        else if (arg == "--migrate") {
+            migrateOnly = true;
+        }
+        else if (arg == "--check-plans") {
+            checkPlansBooks = 100000;
+            if (hasValue && argv[i + 1][0] != '-') checkPlansBooks = std::atoi(argv[++i]);
+        }
+        else {
+            printUsage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    // Схема доводится до текущей версии до подготовки запросов
+    {
+        PGconn* conn = PQconnectdb(connInfo.c_str());
+        checkConn(conn);
+        bool migrated = applyMigrations(conn);
+        if (migrated && checkPlansBooks > 0) {
+            prepareStatements(conn);
+            migrated = checkPlans(conn, checkPlansBooks);
+        }
+        PQfinish(conn);
+        if (!migrated) return 1;
+        if (migrateOnly || checkPlansBooks > 0) return 0;
+    }
+
+    std::unique_ptr<MetricsExporter> metrics;
+    if (!metricsFile.empty()) {
+        metrics.reset(new MetricsExporter(metricsFile, metricsInterval));
+    }
+
+    if (analytics) {
+        // Снимок можно снимать с реплики, чтобы не нагружать основную базу
+        const char* reportDsn = std::getenv("LIBRARY_REPORT_DSN");
+        PGconn* conn = PQconnectdb(reportDsn != nullptr ? reportDsn : connInfo.c_str());
+        checkConn(conn);
+        int code = runAnalytics(conn, analyticsOpts);
+        PQfinish(conn);
+        return code;
+    }
+
+    if (!scriptPath.empty() || !commandLine.empty()) {
+        // Сценарию нужны списки целиком, а не первая страница
+        if (!pageSizeSet) setPageSize(0);
+
+        PGconn* conn = openConnection(connInfo);
+        if (conn == nullptr) return 1;
+
+        long long failed;
+        if (!commandLine.empty()) {
+            std::istringstream input(commandLine);
+            failed = runScript(conn, input, std::cout, script);
+        }
+        else if (scriptPath == "-") {
+            failed = runScript(conn, std::cin, std::cout, script);
+        }
+        else {
+            std::ifstream input(scriptPath);
+            if (!input) {
+                std::cerr << "Не удалось открыть " << scriptPath << std::endl;
+                PQfinish(conn);
+                return 1;
+            }
+            failed = runScript(conn, input, std::cout, script);
+        }
+        PQfinish(conn);
+        return failed == 0 ? 0 : 2;
+    }
+
+    if (archiveOnly) {
+        PGconn* conn = openConnection(connInfo);
+        if (conn == nullptr) return 1;
+        long long moved = archiveLoans(conn, archiveOpts);
+        PQfinish(conn);
+        if (moved < 0) return 1;
+        std::cout << "Перенесено в архив выдач: " << moved << "\n";
+        return 0;
+    }
+
+    std::unique_ptr<LoanArchiver> archiver;
+    if (archiveInterval > 0) {
+        archiver.reset(new LoanArchiver(connInfo, archiveOpts, archiveInterval));
+    }
+
+    if (!service.socketPath.empty()) {
+        // Ответить на запрос следующей страницы клиент не может: ввод
+        // команды — только её аргументы, поэтому списки выдаются целиком
+        if (pageSizeSet && pageSize() != 0) {
+            std::cerr << "В режиме сервиса списки выводятся целиком, --page-size не действует"
+                << std::endl;
+        }
+        setPageSize(0);
+        if (service.workers == 0) service.workers = 1;
+        if (service.poolSize == 0) service.poolSize = service.workers;
+        return runService(connInfo, service);
+    }
+
+    PGconn* conn = PQconnectdb(connInfo.c_str());
 
     checkConn(conn);
+    prepareStatements(conn);
+    ReferenceCache::instance().attach(conn);
 
     while (true) {
         showMainMenu();
@@ -171,7 +428,9 @@ int main() {
         case 2: loansMenu(conn);        break;
         case 3: readersMenu(conn);      break;
         case 4: addReferenceMenu(conn); break;
-        case 5: listReferenceData(conn); break;
+        case 5: runOperation(conn, listReferenceData); break;
+        case 6: runOperation(conn, exportData);        break;
+        case 7: runOperation(conn, printQueryStats);   break;
         case 0:
             PQfinish(conn);
             return 0;
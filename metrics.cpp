@@ -0,0 +1,322 @@
+#include "metrics.h"
+#include "database.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// Границы корзин: время в секундах, строки и байты в штуках
+static const double TIME_BOUNDS[] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01,
+    0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+};
+static const double SIZE_BOUNDS[] = {
+    0, 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000,
+};
+
+const size_t TIME_BUCKETS = sizeof(TIME_BOUNDS) / sizeof(TIME_BOUNDS[0]);
+const size_t SIZE_BUCKETS = sizeof(SIZE_BOUNDS) / sizeof(SIZE_BOUNDS[0]);
+const size_t MAX_BUCKETS = TIME_BUCKETS;
+
+// Время в сумме гистограммы хранится в наносекундах
+const double NS_PER_SECOND = 1e9;
+
+// Гистограмма с фиксированными границами; последняя корзина — +Inf
+struct Histogram {
+    std::atomic<uint64_t> buckets[MAX_BUCKETS + 1];
+    std::atomic<uint64_t> sum;
+
+    void add(const double* bounds, size_t n, double value, uint64_t sumUnits) {
+        size_t i = std::lower_bound(bounds, bounds + n, value) - bounds;
+        buckets[i].fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(sumUnits, std::memory_order_relaxed);
+    }
+
+    uint64_t count(size_t n) const {
+        uint64_t c = 0;
+        for (size_t i = 0; i <= n; ++i) c += buckets[i].load(std::memory_order_relaxed);
+        return c;
+    }
+};
+
+const size_t NAME_SIZE = 64;
+
+// Ячейка таблицы метрик. Занимается один раз и навсегда: state 0 — пусто,
+// 1 — поток записывает имена, 2 — готова. Пустое имя запроса означает
+// длительность всей операции.
+struct MetricSlot {
+    std::atomic<int> state;
+    uint64_t hash;
+    char operation[NAME_SIZE];
+    char statement[NAME_SIZE];
+    Histogram rtt;
+    Histogram render;
+    Histogram rows;
+    Histogram bytes;
+};
+
+const size_t SLOT_COUNT = 512;
+static MetricSlot slots[SLOT_COUNT];
+static std::atomic<uint64_t> droppedSamples;
+
+static thread_local const char* currentOperation = "";
+static thread_local MetricSlot* lastQuery = nullptr;
+
+static uint64_t hashNames(const char* operation, const char* statement) {
+    // FNV-1a по обоим именам с разделителем
+    uint64_t h = 1469598103934665603ULL;
+    for (const char* p = operation; *p; ++p) h = (h ^ static_cast<unsigned char>(*p)) * 1099511628211ULL;
+    h = (h ^ 0xff) * 1099511628211ULL;
+    for (const char* p = statement; *p; ++p) h = (h ^ static_cast<unsigned char>(*p)) * 1099511628211ULL;
+    return h;
+}
+
+static bool sameName(const char* stored, const char* name) {
+    return std::strncmp(stored, name, NAME_SIZE - 1) == 0;
+}
+
+// Ищет ячейку пары имён, при необходимости занимает свободную
+// (открытая адресация с линейным пробированием)
+static MetricSlot* findSlot(const char* operation, const char* statement) {
+    uint64_t h = hashNames(operation, statement);
+    for (size_t probe = 0; probe < SLOT_COUNT; ++probe) {
+        MetricSlot& s = slots[(h + probe) % SLOT_COUNT];
+        int state = s.state.load(std::memory_order_acquire);
+
+        if (state == 0) {
+            int expected = 0;
+            if (s.state.compare_exchange_strong(expected, 1, std::memory_order_acq_rel)) {
+                s.hash = h;
+                std::snprintf(s.operation, NAME_SIZE, "%s", operation);
+                std::snprintf(s.statement, NAME_SIZE, "%s", statement);
+                s.state.store(2, std::memory_order_release);
+                return &s;
+            }
+            state = expected;
+        }
+        while (state == 1) {
+            std::this_thread::yield();
+            state = s.state.load(std::memory_order_acquire);
+        }
+        if (s.hash == h && sameName(s.operation, operation) && sameName(s.statement, statement)) {
+            return &s;
+        }
+    }
+    droppedSamples.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+}
+
+static void addTime(Histogram& h, MetricsClock::duration d) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    if (ns < 0) ns = 0;
+    h.add(TIME_BOUNDS, TIME_BUCKETS, ns / NS_PER_SECOND, static_cast<uint64_t>(ns));
+}
+
+static void addSize(Histogram& h, long long value) {
+    h.add(SIZE_BOUNDS, SIZE_BUCKETS, static_cast<double>(value), static_cast<uint64_t>(value));
+}
+
+OperationScope::OperationScope(const char* name)
+    : saved(currentOperation), start(MetricsClock::now()) {
+    currentOperation = name;
+    lastQuery = nullptr;
+}
+
+OperationScope::~OperationScope() {
+    if (MetricSlot* s = findSlot(currentOperation, "")) {
+        addTime(s->rtt, MetricsClock::now() - start);
+    }
+    currentOperation = saved;
+    lastQuery = nullptr;
+}
+
+void recordQuery(const std::string& statement, MetricsClock::duration rtt,
+    long long rows, long long bytes) {
+    MetricSlot* s = findSlot(currentOperation, statement.c_str());
+    lastQuery = s;
+    if (s == nullptr) return;
+    addTime(s->rtt, rtt);
+    addSize(s->rows, rows);
+    addSize(s->bytes, bytes);
+}
+
+void recordQuery(const std::string& statement, MetricsClock::duration rtt, const PGresult* res) {
+    long long rows = PQntuples(res);
+    long long bytes = 0;
+    int cols = PQnfields(res);
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < cols; ++j) bytes += PQgetlength(res, i, j);
+    }
+    recordQuery(statement, rtt, rows, bytes);
+}
+
+void recordRender(MetricsClock::duration elapsed) {
+    if (lastQuery == nullptr) return;
+    addTime(lastQuery->render, elapsed);
+    lastQuery = nullptr;
+}
+
+static std::vector<const MetricSlot*> readySlots() {
+    std::vector<const MetricSlot*> ready;
+    for (const auto& s : slots) {
+        if (s.state.load(std::memory_order_acquire) == 2) ready.push_back(&s);
+    }
+    std::sort(ready.begin(), ready.end(), [](const MetricSlot* a, const MetricSlot* b) {
+        int c = std::strcmp(a->operation, b->operation);
+        return c != 0 ? c < 0 : std::strcmp(a->statement, b->statement) < 0;
+    });
+    return ready;
+}
+
+static std::string labelValue(const char* s) {
+    std::string r;
+    for (; *s; ++s) {
+        if (*s == '\\' || *s == '"') r += '\\';
+        if (*s == '\n') {
+            r += "\\n";
+            continue;
+        }
+        r += *s;
+    }
+    return r;
+}
+
+static std::string number(double v) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%g", v);
+    return buf;
+}
+
+static void writeHistogram(std::ostream& os, const char* metric, const char* help,
+    const std::vector<const MetricSlot*>& ready, bool operations,
+    Histogram MetricSlot::*field, const double* bounds, size_t n, double sumScale) {
+    os << "# HELP " << metric << ' ' << help << "\n"
+       << "# TYPE " << metric << " histogram\n";
+    for (const MetricSlot* s : ready) {
+        if ((*s->statement == '\0') != operations) continue;
+        const Histogram& h = s->*field;
+        uint64_t total = h.count(n);
+        if (total == 0) continue;
+
+        std::string labels = "operation=\"" + labelValue(s->operation) + "\"";
+        if (!operations) labels += ",statement=\"" + labelValue(s->statement) + "\"";
+
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i <= n; ++i) {
+            cumulative += h.buckets[i].load(std::memory_order_relaxed);
+            os << metric << "_bucket{" << labels << ",le=\""
+               << (i < n ? number(bounds[i]) : "+Inf") << "\"} " << cumulative << "\n";
+        }
+        os << metric << "_sum{" << labels << "} "
+           << number(h.sum.load(std::memory_order_relaxed) / sumScale) << "\n"
+           << metric << "_count{" << labels << "} " << cumulative << "\n";
+    }
+}
+
+bool writeMetricsFile(const std::string& path) {
+    std::vector<const MetricSlot*> ready = readySlots();
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream os(tmp, std::ios::trunc);
+        if (!os) return false;
+
+        writeHistogram(os, "library_operation_duration_seconds",
+            "Длительность логической операции целиком",
+            ready, true, &MetricSlot::rtt, TIME_BOUNDS, TIME_BUCKETS, NS_PER_SECOND);
+        writeHistogram(os, "library_query_duration_seconds",
+            "Время от отправки запроса до получения результата (сеть и сервер)",
+            ready, false, &MetricSlot::rtt, TIME_BOUNDS, TIME_BUCKETS, NS_PER_SECOND);
+        writeHistogram(os, "library_query_rows",
+            "Строк в результате запроса",
+            ready, false, &MetricSlot::rows, SIZE_BOUNDS, SIZE_BUCKETS, 1);
+        writeHistogram(os, "library_query_response_bytes",
+            "Байт данных в результате запроса",
+            ready, false, &MetricSlot::bytes, SIZE_BOUNDS, SIZE_BUCKETS, 1);
+        writeHistogram(os, "library_render_duration_seconds",
+            "Время вывода результата на клиенте",
+            ready, false, &MetricSlot::render, TIME_BOUNDS, TIME_BUCKETS, NS_PER_SECOND);
+
+        os << "# HELP library_metrics_dropped_total Замеры, не поместившиеся в таблицу метрик\n"
+           << "# TYPE library_metrics_dropped_total counter\n"
+           << "library_metrics_dropped_total " << droppedSamples.load() << "\n";
+        if (!os) return false;
+    }
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+// Верхняя граница корзины, в которую попадает перцентиль p, в миллисекундах
+static std::string timePercentile(const Histogram& h, double p) {
+    uint64_t total = h.count(TIME_BUCKETS);
+    if (total == 0) return "";
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < TIME_BUCKETS; ++i) {
+        cumulative += h.buckets[i].load(std::memory_order_relaxed);
+        if (cumulative >= p * total) return "≤ " + number(TIME_BOUNDS[i] * 1000);
+    }
+    return "> " + number(TIME_BOUNDS[TIME_BUCKETS - 1] * 1000);
+}
+
+static std::string average(const Histogram& h, size_t n, double scale) {
+    uint64_t total = h.count(n);
+    if (total == 0) return "";
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.2f", h.sum.load(std::memory_order_relaxed) / scale / total);
+    return buf;
+}
+
+void printQueryStats(PGconn*) {
+    std::vector<std::vector<std::string>> rows;
+    for (const MetricSlot* s : readySlots()) {
+        bool operation = (*s->statement == '\0');
+        rows.push_back({
+            *s->operation ? s->operation : "-",
+            operation ? "(вся операция)" : s->statement,
+            std::to_string(s->rtt.count(TIME_BUCKETS)),
+            average(s->rtt, TIME_BUCKETS, 1e6),
+            timePercentile(s->rtt, 0.5),
+            timePercentile(s->rtt, 0.99),
+            operation ? "" : average(s->rows, SIZE_BUCKETS, 1),
+            operation ? "" : average(s->bytes, SIZE_BUCKETS, 1),
+            operation ? "" : average(s->render, TIME_BUCKETS, 1e6),
+        });
+    }
+    if (rows.empty()) {
+        out() << "Замеров пока нет.\n";
+        return;
+    }
+
+    PGresult* res = makeTextResult({ "операция", "запрос", "вызовов", "мс, среднее",
+        "мс, p50", "мс, p99", "строк", "байт", "вывод, мс" }, rows);
+    printResult(res);
+    PQclear(res);
+}
+
+MetricsExporter::MetricsExporter(const std::string& path, int intervalSeconds)
+    : path(path), interval(std::max(intervalSeconds, 1)) {
+    worker = std::thread(&MetricsExporter::run, this);
+}
+
+MetricsExporter::~MetricsExporter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+    writeMetricsFile(path);
+}
+
+void MetricsExporter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!wake.wait_for(lock, interval, [this] { return stopping; })) {
+        lock.unlock();
+        if (!writeMetricsFile(path)) {
+            std::cerr << "Не удалось записать метрики в " << path << std::endl;
+        }
+        lock.lock();
+    }
+}
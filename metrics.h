@@ -0,0 +1,61 @@
+#pragma once
+#include <libpq-fe.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Замеры запросов по паре (логическая операция, запрос): время от отправки
+// до результата (сеть и сервер), строки и байты результата, время вывода
+// на клиенте. Гистограммы обновляются атомарно, без блокировок.
+
+using MetricsClock = std::chrono::steady_clock;
+
+// Логическая операция текущего потока (команда или пункт меню);
+// длительность всей операции тоже записывается
+class OperationScope {
+public:
+    explicit OperationScope(const char* name);
+    ~OperationScope();
+    OperationScope(const OperationScope&) = delete;
+    OperationScope& operator=(const OperationScope&) = delete;
+
+private:
+    const char* saved;
+    MetricsClock::time_point start;
+};
+
+// Результат запроса получен за rtt
+void recordQuery(const std::string& statement, MetricsClock::duration rtt, const PGresult* res);
+void recordQuery(const std::string& statement, MetricsClock::duration rtt,
+    long long rows, long long bytes);
+
+// Вывод результата последнего записанного запроса этого потока
+void recordRender(MetricsClock::duration elapsed);
+
+// Все гистограммы в текстовом формате Prometheus; файл заменяется целиком
+bool writeMetricsFile(const std::string& path);
+
+// Сводная таблица по операциям и запросам
+void printQueryStats(PGconn* conn);
+
+// Периодическая запись файла метрик из фонового потока;
+// при остановке файл записывается последний раз
+class MetricsExporter {
+public:
+    MetricsExporter(const std::string& path, int intervalSeconds);
+    ~MetricsExporter();
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+private:
+    void run();
+
+    std::string path;
+    std::chrono::seconds interval;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread worker;
+};
@@ -0,0 +1,741 @@
+#include "migrations.h"
+#include "database.h"
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+static const std::vector<Migration>& migrationList() {
+    static const std::vector<Migration> list = {
+        { 1, "индексы по выдачам, внешним ключам и фильтрам книг",
+          // Активные выдачи: списки, выдачи читателя, проверки при удалении
+          "CREATE INDEX loans_open_idx ON loans (loan_id) "
+          "    WHERE return_date IS NULL; "
+          "CREATE INDEX loans_open_reader_idx ON loans (reader_id) "
+          "    WHERE return_date IS NULL; "
+          "CREATE INDEX loans_open_book_idx ON loans (book_id) "
+          "    WHERE return_date IS NULL; "
+          // Внешние ключи
+          "CREATE INDEX loans_book_idx ON loans (book_id); "
+          "CREATE INDEX loans_reader_idx ON loans (reader_id); "
+          "CREATE INDEX books_author_idx ON books (author_id); "
+          "CREATE INDEX books_genre_idx ON books (genre_id); "
+          "CREATE INDEX books_publisher_idx ON books (publisher_id); "
+          "CREATE INDEX books_language_idx ON books (language_id); "
+          // Фильтры и поиск совпадающей книги в addBook
+          "CREATE INDEX books_year_idx ON books (year, book_id); "
+          "CREATE INDEX books_pages_idx ON books (pages, book_id); "
+          "CREATE INDEX books_free_idx ON books (book_id) "
+          "    WHERE copies_available > 0; "
+          "CREATE INDEX books_title_idx ON books (title, author_id);" },
+
+        { 2, "денормализованная карточка книги book_cards",
+          // Готовая карточка для списков и фильтров: названия справочников
+          // и статус хранятся рядом с книгой, соединения не нужны
+          "CREATE TABLE book_cards ("
+          "    book_id          INT PRIMARY KEY "
+          "                     REFERENCES books ON DELETE CASCADE ON UPDATE CASCADE, "
+          "    title            VARCHAR(150) NOT NULL, "
+          "    author_id        INT, "
+          "    author           VARCHAR(100), "
+          "    genre_id         INT, "
+          "    genre            VARCHAR(50), "
+          "    publisher_id     INT, "
+          "    publisher        VARCHAR(100), "
+          "    language_id      INT, "
+          "    language         VARCHAR(50), "
+          "    year             INT, "
+          "    pages            INT, "
+          "    copies_total     INT, "
+          "    copies_available INT, "
+          "    status           TEXT GENERATED ALWAYS AS ("
+          "                         CASE WHEN copies_available > 0 "
+          "                              THEN 'Есть в наличии' ELSE 'Нет в наличии' END"
+          "                     ) STORED"
+          "); "
+          "CREATE INDEX book_cards_year_idx ON book_cards (year, book_id); "
+          "CREATE INDEX book_cards_pages_idx ON book_cards (pages, book_id); "
+          "CREATE INDEX book_cards_author_idx ON book_cards (author_id, book_id); "
+          "CREATE INDEX book_cards_genre_idx ON book_cards (genre_id, book_id); "
+          "CREATE INDEX book_cards_publisher_idx ON book_cards (publisher_id, book_id); "
+          "CREATE INDEX book_cards_language_idx ON book_cards (language_id, book_id); "
+          "CREATE INDEX book_cards_free_idx ON book_cards (book_id) "
+          "    WHERE copies_available > 0; "
+
+          // Карточки добавленных и изменённых книг пересобираются одним
+          // оператором на каждый оператор над books (таблицы переходов),
+          // поэтому COPY и пакетные возвраты не вызывают триггер на строку.
+          // Удаление книги удаляет карточку внешним ключом.
+          "CREATE FUNCTION book_cards_upsert() RETURNS trigger AS $$ "
+          "BEGIN "
+          "    INSERT INTO book_cards (book_id, title, author_id, author, genre_id, genre, "
+          "                            publisher_id, publisher, language_id, language, "
+          "                            year, pages, copies_total, copies_available) "
+          "    SELECT n.book_id, n.title, n.author_id, a.name, n.genre_id, g.name, "
+          "           n.publisher_id, p.name, n.language_id, l.name, "
+          "           n.year, n.pages, n.copies_total, n.copies_available "
+          "    FROM changed_books n "
+          "    LEFT JOIN authors a    ON a.author_id = n.author_id "
+          "    LEFT JOIN genres g     ON g.genre_id = n.genre_id "
+          "    LEFT JOIN publishers p ON p.publisher_id = n.publisher_id "
+          "    LEFT JOIN languages l  ON l.language_id = n.language_id "
+          "    ON CONFLICT (book_id) DO UPDATE "
+          "    SET title = EXCLUDED.title, "
+          "        author_id = EXCLUDED.author_id, author = EXCLUDED.author, "
+          "        genre_id = EXCLUDED.genre_id, genre = EXCLUDED.genre, "
+          "        publisher_id = EXCLUDED.publisher_id, publisher = EXCLUDED.publisher, "
+          "        language_id = EXCLUDED.language_id, language = EXCLUDED.language, "
+          "        year = EXCLUDED.year, pages = EXCLUDED.pages, "
+          "        copies_total = EXCLUDED.copies_total, "
+          "        copies_available = EXCLUDED.copies_available; "
+          "    RETURN NULL; "
+          "END; "
+          "$$ LANGUAGE plpgsql; "
+          "CREATE TRIGGER book_cards_insert AFTER INSERT ON books "
+          "    REFERENCING NEW TABLE AS changed_books "
+          "    FOR EACH STATEMENT EXECUTE FUNCTION book_cards_upsert(); "
+          "CREATE TRIGGER book_cards_update AFTER UPDATE ON books "
+          "    REFERENCING NEW TABLE AS changed_books "
+          "    FOR EACH STATEMENT EXECUTE FUNCTION book_cards_upsert(); "
+
+          // Переименование в справочнике меняет только его столбец карточек
+          "CREATE FUNCTION book_cards_author_name() RETURNS trigger AS $$ "
+          "BEGIN "
+          "    UPDATE book_cards SET author = NEW.name WHERE author_id = NEW.author_id; "
+          "    RETURN NULL; "
+          "END; "
+          "$$ LANGUAGE plpgsql; "
+          "CREATE TRIGGER book_cards_author AFTER UPDATE OF name ON authors "
+          "    FOR EACH ROW WHEN (OLD.name IS DISTINCT FROM NEW.name) "
+          "    EXECUTE FUNCTION book_cards_author_name(); "
+          "CREATE FUNCTION book_cards_genre_name() RETURNS trigger AS $$ "
+          "BEGIN "
+          "    UPDATE book_cards SET genre = NEW.name WHERE genre_id = NEW.genre_id; "
+          "    RETURN NULL; "
+          "END; "
+          "$$ LANGUAGE plpgsql; "
+          "CREATE TRIGGER book_cards_genre AFTER UPDATE OF name ON genres "
+          "    FOR EACH ROW WHEN (OLD.name IS DISTINCT FROM NEW.name) "
+          "    EXECUTE FUNCTION book_cards_genre_name(); "
+          "CREATE FUNCTION book_cards_publisher_name() RETURNS trigger AS $$ "
+          "BEGIN "
+          "    UPDATE book_cards SET publisher = NEW.name WHERE publisher_id = NEW.publisher_id; "
+          "    RETURN NULL; "
+          "END; "
+          "$$ LANGUAGE plpgsql; "
+          "CREATE TRIGGER book_cards_publisher AFTER UPDATE OF name ON publishers "
+          "    FOR EACH ROW WHEN (OLD.name IS DISTINCT FROM NEW.name) "
+          "    EXECUTE FUNCTION book_cards_publisher_name(); "
+          "CREATE FUNCTION book_cards_language_name() RETURNS trigger AS $$ "
+          "BEGIN "
+          "    UPDATE book_cards SET language = NEW.name WHERE language_id = NEW.language_id; "
+          "    RETURN NULL; "
+          "END; "
+          "$$ LANGUAGE plpgsql; "
+          "CREATE TRIGGER book_cards_language AFTER UPDATE OF name ON languages "
+          "    FOR EACH ROW WHEN (OLD.name IS DISTINCT FROM NEW.name) "
+          "    EXECUTE FUNCTION book_cards_language_name(); "
+
+          // Карточки существующих книг
+          "INSERT INTO book_cards (book_id, title, author_id, author, genre_id, genre, "
+          "                        publisher_id, publisher, language_id, language, "
+          "                        year, pages, copies_total, copies_available) "
+          "SELECT b.book_id, b.title, b.author_id, a.name, b.genre_id, g.name, "
+          "       b.publisher_id, p.name, b.language_id, l.name, "
+          "       b.year, b.pages, b.copies_total, b.copies_available "
+          "FROM books b "
+          "LEFT JOIN authors a    ON a.author_id = b.author_id "
+          "LEFT JOIN genres g     ON g.genre_id = b.genre_id "
+          "LEFT JOIN publishers p ON p.publisher_id = b.publisher_id "
+          "LEFT JOIN languages l  ON l.language_id = b.language_id; "
+          "ANALYZE book_cards;" },
+
+        { 3, "полнотекстовый поиск по названию и автору",
+          // Конфигурация russian разбирает кириллицу русским стеммером,
+          // а слова латиницей — английским, поэтому один вектор
+          // покрывает оба языка. Название весит больше автора.
+          "ALTER TABLE book_cards ADD COLUMN search tsvector; "
+          "CREATE FUNCTION book_cards_search() RETURNS trigger AS $$ "
+          "BEGIN "
+          "    NEW.search := setweight(to_tsvector('russian', COALESCE(NEW.title, '')), 'A') || "
+          "                  setweight(to_tsvector('russian', COALESCE(NEW.author, '')), 'B'); "
+          "    RETURN NEW; "
+          "END; "
+          "$$ LANGUAGE plpgsql; "
+          // Триггер на вставку срабатывает и на INSERT … ON CONFLICT из
+          // book_cards_upsert(), то есть на каждую выдачу и возврат; миграция 8
+          // заменяет его расчётом вектора в самом операторе
+          "CREATE TRIGGER book_cards_search_insert BEFORE INSERT ON book_cards "
+          "    FOR EACH ROW EXECUTE FUNCTION book_cards_search(); "
+          // При изменении существующей карточки вектор пересчитывается,
+          // только если изменились название или автор
+          "CREATE TRIGGER book_cards_search_update BEFORE UPDATE OF title, author ON book_cards "
+          "    FOR EACH ROW "
+          "    WHEN (OLD.title IS DISTINCT FROM NEW.title "
+          "          OR OLD.author IS DISTINCT FROM NEW.author) "
+          "    EXECUTE FUNCTION book_cards_search(); "
+          "UPDATE book_cards "
+          "SET search = setweight(to_tsvector('russian', COALESCE(title, '')), 'A') || "
+          "             setweight(to_tsvector('russian', COALESCE(author, '')), 'B'); "
+          "CREATE INDEX book_cards_search_idx ON book_cards USING GIN (search); "
+          "ANALYZE book_cards;" },
+
+        { 4, "очередь ожидания книг и возврат с передачей экземпляра",
+          "CREATE TABLE holds ("
+          "    hold_id      SERIAL PRIMARY KEY, "
+          "    book_id      INT NOT NULL REFERENCES books ON DELETE CASCADE, "
+          "    reader_id    INT NOT NULL REFERENCES readers, "
+          "    placed_at    TIMESTAMPTZ NOT NULL DEFAULT now(), "
+          "    status       TEXT NOT NULL DEFAULT 'waiting' "
+          "                 CHECK (status IN ('waiting', 'fulfilled', 'cancelled')), "
+          "    loan_id      INT REFERENCES loans ON DELETE SET NULL, "
+          "    closed_at    TIMESTAMPTZ"
+          "); "
+          // Очередь книги по порядку постановки и не больше одной
+          // ожидающей заявки читателя на книгу
+          "CREATE INDEX holds_queue_idx ON holds (book_id, hold_id) "
+          "    WHERE status = 'waiting'; "
+          "CREATE UNIQUE INDEX holds_waiting_reader_idx ON holds (book_id, reader_id) "
+          "    WHERE status = 'waiting'; "
+          "CREATE INDEX holds_reader_idx ON holds (reader_id); "
+          "CREATE INDEX holds_loan_idx ON holds (loan_id); "
+
+          // Возврат пачки выдач в порядке списка. Освободившийся экземпляр
+          // сразу выдаётся первой незанятой заявке очереди: SKIP LOCKED
+          // пропускает заявки, которые сейчас обслуживают параллельные
+          // возвраты той же книги, а строка книги меняется, только если
+          // экземпляр вернулся на полку. Поэтому возвраты популярной книги
+          // с очередью не ждут друг друга на одной блокировке.
+          "CREATE FUNCTION return_loans(ids INT[], d DATE) "
+          "    RETURNS TABLE (loan_id INT, returned BOOLEAN, hold_loan_id INT) AS $$ "
+          "#variable_conflict use_column "
+          "DECLARE "
+          "    id        INT; "
+          "    book      INT; "
+          "    next_hold RECORD; "
+          "BEGIN "
+          "    FOREACH id IN ARRAY ids LOOP "
+          "        loan_id := id; "
+          "        hold_loan_id := NULL; "
+          "        UPDATE loans l SET return_date = d "
+          "        WHERE l.loan_id = id AND l.return_date IS NULL "
+          "        RETURNING l.book_id INTO book; "
+          "        returned := FOUND; "
+          "        IF returned THEN "
+          "            SELECT h.hold_id, h.reader_id INTO next_hold "
+          "            FROM holds h "
+          "            WHERE h.book_id = book AND h.status = 'waiting' "
+          "            ORDER BY h.hold_id "
+          "            LIMIT 1 "
+          "            FOR UPDATE SKIP LOCKED; "
+          "            IF FOUND THEN "
+          "                INSERT INTO loans (book_id, reader_id, loan_date) "
+          "                VALUES (book, next_hold.reader_id, d) "
+          "                RETURNING loans.loan_id INTO hold_loan_id; "
+          "                UPDATE holds "
+          "                SET status = 'fulfilled', loan_id = hold_loan_id, closed_at = now() "
+          "                WHERE hold_id = next_hold.hold_id; "
+          "            ELSE "
+          "                UPDATE books b "
+          "                SET copies_available = LEAST(b.copies_available + 1, b.copies_total) "
+          "                WHERE b.book_id = book; "
+          "            END IF; "
+          "        END IF; "
+          "        RETURN NEXT; "
+          "    END LOOP; "
+          "END; "
+          "$$ LANGUAGE plpgsql;" },
+
+        { 5, "архив закрытых выдач loans_archive",
+          // В loans остаются открытые и недавно закрытые выдачи, старые
+          // закрытые переносятся в архив пачками (archive.cpp), так что
+          // таблица и её индексы растут с текущим оборотом, а не с историей.
+          // Существующая история переносится тем же фоновым переносом, а не
+          // миграцией, чтобы не держать блокировку на всё время переноса.
+          "CREATE TABLE loans_archive ("
+          "    loan_id     INT PRIMARY KEY, "
+          "    book_id     INT REFERENCES books(book_id), "
+          "    reader_id   INT REFERENCES readers(reader_id), "
+          "    loan_date   DATE NOT NULL, "
+          "    return_date DATE NOT NULL"
+          "); "
+          "CREATE INDEX loans_archive_book_idx ON loans_archive (book_id); "
+          "CREATE INDEX loans_archive_reader_idx ON loans_archive (reader_id); "
+          // Кандидаты на перенос — по дате возврата
+          "CREATE INDEX loans_closed_idx ON loans (return_date, loan_id) "
+          "    WHERE return_date IS NOT NULL; "
+          // Выдача по заявке остаётся в истории и после переноса в архив
+          "ALTER TABLE holds DROP CONSTRAINT holds_loan_id_fkey; "
+          // Вся история выдач для отчётов и выгрузки
+          "CREATE VIEW loan_history AS "
+          "    SELECT loan_id, book_id, reader_id, loan_date, return_date FROM loans "
+          "    UNION ALL "
+          "    SELECT loan_id, book_id, reader_id, loan_date, return_date FROM loans_archive;" },
+
+        { 6, "естественный ключ книги для пополнения каталога одним оператором",
+          // Дубликаты, появившиеся раньше (одновременное добавление одной
+          // книги), сливаются в книгу с меньшим ID: экземпляры складываются,
+          // выдачи и заявки переходят к ней. Из повторных ожидающих заявок
+          // одного читателя остаётся первая.
+          "CREATE TEMP TABLE book_duplicates ON COMMIT DROP AS "
+          "SELECT book_id, keep_id FROM ("
+          "    SELECT book_id, MIN(book_id) OVER (PARTITION BY title, author_id, genre_id, "
+          "                   publisher_id, language_id, year, pages) AS keep_id "
+          "    FROM books) d "
+          "WHERE book_id <> keep_id; "
+          "UPDATE books b "
+          "SET copies_total = b.copies_total + d.total, "
+          "    copies_available = b.copies_available + d.available "
+          "FROM (SELECT d.keep_id, SUM(x.copies_total) AS total, "
+          "             SUM(x.copies_available) AS available "
+          "      FROM book_duplicates d JOIN books x ON x.book_id = d.book_id "
+          "      GROUP BY d.keep_id) d "
+          "WHERE b.book_id = d.keep_id; "
+          "UPDATE holds h SET status = 'cancelled', closed_at = now() "
+          "FROM (SELECT h.hold_id, ROW_NUMBER() OVER ("
+          "             PARTITION BY COALESCE(d.keep_id, h.book_id), h.reader_id "
+          "             ORDER BY h.hold_id) AS n "
+          "      FROM holds h LEFT JOIN book_duplicates d ON d.book_id = h.book_id "
+          "      WHERE h.status = 'waiting') r "
+          "WHERE h.hold_id = r.hold_id AND r.n > 1; "
+          "UPDATE holds h SET book_id = d.keep_id "
+          "FROM book_duplicates d WHERE h.book_id = d.book_id; "
+          "UPDATE loans l SET book_id = d.keep_id "
+          "FROM book_duplicates d WHERE l.book_id = d.book_id; "
+          "UPDATE loans_archive l SET book_id = d.keep_id "
+          "FROM book_duplicates d WHERE l.book_id = d.book_id; "
+          "DELETE FROM books b USING book_duplicates d WHERE b.book_id = d.book_id; "
+          // Книги без автора, года и т.п. тоже не дублируются
+          "CREATE UNIQUE INDEX books_natural_key ON books "
+          "    (title, author_id, genre_id, publisher_id, language_id, year, pages) "
+          "    NULLS NOT DISTINCT; "
+          // Начало нового ключа, поиску по названию и автору он тоже подходит
+          "DROP INDEX books_title_idx;" },
+
+        { 7, "уведомления об изменении справочников для кэша клиента",
+          // Формат: таблица|операция|id|название, операции U (вставка или
+          // изменение), D (удаление), T (очистка таблицы). Базы, созданные
+          // прежним library.sql, уже содержат функцию и триггеры: они
+          // заменяются на месте.
+          "CREATE OR REPLACE FUNCTION notify_reference_change() RETURNS trigger AS $$ "
+          "DECLARE "
+          "    id_column text := TG_ARGV[0]; "
+          "BEGIN "
+          "    IF TG_OP = 'TRUNCATE' THEN "
+          "        PERFORM pg_notify('reference_changed', TG_TABLE_NAME || '|T||'); "
+          "        RETURN NULL; "
+          "    END IF; "
+          "    IF TG_OP IN ('DELETE', 'UPDATE') THEN "
+          "        IF TG_OP = 'DELETE' "
+          "           OR (to_jsonb(OLD) ->> id_column) <> (to_jsonb(NEW) ->> id_column) THEN "
+          "            PERFORM pg_notify('reference_changed', "
+          "                TG_TABLE_NAME || '|D|' || (to_jsonb(OLD) ->> id_column) || '|'); "
+          "        END IF; "
+          "    END IF; "
+          "    IF TG_OP IN ('INSERT', 'UPDATE') THEN "
+          "        PERFORM pg_notify('reference_changed', "
+          "            TG_TABLE_NAME || '|U|' || (to_jsonb(NEW) ->> id_column) || '|' || NEW.name); "
+          "    END IF; "
+          "    RETURN NULL; "
+          "END; "
+          "$$ LANGUAGE plpgsql; "
+          "CREATE OR REPLACE TRIGGER authors_notify "
+          "    AFTER INSERT OR UPDATE OR DELETE ON authors "
+          "    FOR EACH ROW EXECUTE FUNCTION notify_reference_change('author_id'); "
+          "CREATE OR REPLACE TRIGGER authors_notify_truncate AFTER TRUNCATE ON authors "
+          "    FOR EACH STATEMENT EXECUTE FUNCTION notify_reference_change('author_id'); "
+          "CREATE OR REPLACE TRIGGER genres_notify "
+          "    AFTER INSERT OR UPDATE OR DELETE ON genres "
+          "    FOR EACH ROW EXECUTE FUNCTION notify_reference_change('genre_id'); "
+          "CREATE OR REPLACE TRIGGER genres_notify_truncate AFTER TRUNCATE ON genres "
+          "    FOR EACH STATEMENT EXECUTE FUNCTION notify_reference_change('genre_id'); "
+          "CREATE OR REPLACE TRIGGER publishers_notify "
+          "    AFTER INSERT OR UPDATE OR DELETE ON publishers "
+          "    FOR EACH ROW EXECUTE FUNCTION notify_reference_change('publisher_id'); "
+          "CREATE OR REPLACE TRIGGER publishers_notify_truncate AFTER TRUNCATE ON publishers "
+          "    FOR EACH STATEMENT EXECUTE FUNCTION notify_reference_change('publisher_id'); "
+          "CREATE OR REPLACE TRIGGER languages_notify "
+          "    AFTER INSERT OR UPDATE OR DELETE ON languages "
+          "    FOR EACH ROW EXECUTE FUNCTION notify_reference_change('language_id'); "
+          "CREATE OR REPLACE TRIGGER languages_notify_truncate AFTER TRUNCATE ON languages "
+          "    FOR EACH STATEMENT EXECUTE FUNCTION notify_reference_change('language_id');" },
+
+        { 8, "вектор поиска только для новых карточек и при смене названия или автора",
+          // BEFORE INSERT срабатывает до проверки конфликта, поэтому прежний
+          // триггер считал вектор при каждом пополнении карточки и отбрасывал
+          // его. Теперь вектор считается в операторе только для книг, у которых
+          // карточки ещё нет; у существующих его пересчитывает триггер
+          // book_cards_search_update, если изменились название или автор.
+          "DROP TRIGGER book_cards_search_insert ON book_cards; "
+          "CREATE OR REPLACE FUNCTION book_cards_upsert() RETURNS trigger AS $$ "
+          "BEGIN "
+          "    INSERT INTO book_cards (book_id, title, author_id, author, genre_id, genre, "
+          "                            publisher_id, publisher, language_id, language, "
+          "                            year, pages, copies_total, copies_available, search) "
+          "    SELECT n.book_id, n.title, n.author_id, a.name, n.genre_id, g.name, "
+          "           n.publisher_id, p.name, n.language_id, l.name, "
+          "           n.year, n.pages, n.copies_total, n.copies_available, "
+          "           CASE WHEN c.book_id IS NULL THEN "
+          "               setweight(to_tsvector('russian', COALESCE(n.title, '')), 'A') || "
+          "               setweight(to_tsvector('russian', COALESCE(a.name, '')), 'B') "
+          "           END "
+          "    FROM changed_books n "
+          "    LEFT JOIN book_cards c ON c.book_id = n.book_id "
+          "    LEFT JOIN authors a    ON a.author_id = n.author_id "
+          "    LEFT JOIN genres g     ON g.genre_id = n.genre_id "
+          "    LEFT JOIN publishers p ON p.publisher_id = n.publisher_id "
+          "    LEFT JOIN languages l  ON l.language_id = n.language_id "
+          "    ON CONFLICT (book_id) DO UPDATE "
+          "    SET title = EXCLUDED.title, "
+          "        author_id = EXCLUDED.author_id, author = EXCLUDED.author, "
+          "        genre_id = EXCLUDED.genre_id, genre = EXCLUDED.genre, "
+          "        publisher_id = EXCLUDED.publisher_id, publisher = EXCLUDED.publisher, "
+          "        language_id = EXCLUDED.language_id, language = EXCLUDED.language, "
+          "        year = EXCLUDED.year, pages = EXCLUDED.pages, "
+          "        copies_total = EXCLUDED.copies_total, "
+          "        copies_available = EXCLUDED.copies_available; "
+          "    RETURN NULL; "
+          "END; "
+          "$$ LANGUAGE plpgsql;" },
+
+        { 9, "возврат на полку под блокировкой книги, если очередь пуста",
+          // Заявка (hold_place) ставится под блокировкой строки книги. Если
+          // возврат не нашёл заявок без блокировки, он берёт ту же
+          // блокировку и ищет снова: заявка, поставленная за это время, уже
+          // зафиксирована и получает экземпляр, а более поздняя увидит его
+          // на полке и не будет поставлена. Так экземпляр не остаётся на
+          // полке при ожидающей заявке. Возвраты книги с очередью по-прежнему
+          // не ждут блокировки книги.
+          "CREATE OR REPLACE FUNCTION return_loans(ids INT[], d DATE) "
+          "    RETURNS TABLE (loan_id INT, returned BOOLEAN, hold_loan_id INT) AS $$ "
+          "#variable_conflict use_column "
+          "DECLARE "
+          "    id        INT; "
+          "    book      INT; "
+          "    next_hold RECORD; "
+          "BEGIN "
+          "    FOREACH id IN ARRAY ids LOOP "
+          "        loan_id := id; "
+          "        hold_loan_id := NULL; "
+          "        UPDATE loans l SET return_date = d "
+          "        WHERE l.loan_id = id AND l.return_date IS NULL "
+          "        RETURNING l.book_id INTO book; "
+          "        returned := FOUND; "
+          "        IF returned THEN "
+          "            SELECT h.hold_id, h.reader_id INTO next_hold "
+          "            FROM holds h "
+          "            WHERE h.book_id = book AND h.status = 'waiting' "
+          "            ORDER BY h.hold_id "
+          "            LIMIT 1 "
+          "            FOR UPDATE SKIP LOCKED; "
+          "            IF NOT FOUND THEN "
+          "                PERFORM 1 FROM books b WHERE b.book_id = book FOR UPDATE; "
+          "                SELECT h.hold_id, h.reader_id INTO next_hold "
+          "                FROM holds h "
+          "                WHERE h.book_id = book AND h.status = 'waiting' "
+          "                ORDER BY h.hold_id "
+          "                LIMIT 1 "
+          "                FOR UPDATE SKIP LOCKED; "
+          "            END IF; "
+          "            IF FOUND THEN "
+          "                INSERT INTO loans (book_id, reader_id, loan_date) "
+          "                VALUES (book, next_hold.reader_id, d) "
+          "                RETURNING loans.loan_id INTO hold_loan_id; "
+          "                UPDATE holds "
+          "                SET status = 'fulfilled', loan_id = hold_loan_id, closed_at = now() "
+          "                WHERE hold_id = next_hold.hold_id; "
+          "            ELSE "
+          "                UPDATE books b "
+          "                SET copies_available = LEAST(b.copies_available + 1, b.copies_total) "
+          "                WHERE b.book_id = book; "
+          "            END IF; "
+          "        END IF; "
+          "        RETURN NEXT; "
+          "    END LOOP; "
+          "END; "
+          "$$ LANGUAGE plpgsql;" },
+
+        { 10, "выдача по заявкам при любом пополнении свободных экземпляров",
+          // Очередь обслуживал только возврат, а пополнение каталога
+          // (add-book, book_upsert, загрузка) клало экземпляры на полку при
+          // ожидающих заявках. Теперь любое увеличение copies_available
+          // выдаёт новые экземпляры первым заявкам очереди, датой выдачи
+          // служит текущая дата. Строка книги уже заблокирована изменением,
+          // как и у hold_place, поэтому заявка не встанет в очередь мимо
+          // пополнения. Заявки, которые сейчас обслуживают возвраты,
+          // пропускаются (SKIP LOCKED). Уменьшение copies_available триггер
+          // не вызывает, так что его собственное изменение книги его не
+          // запускает заново.
+          "CREATE FUNCTION serve_holds() RETURNS trigger AS $$ "
+          "DECLARE "
+          "    free      INT := NEW.copies_available; "
+          "    next_hold RECORD; "
+          "    new_loan  INT; "
+          "BEGIN "
+          "    FOR next_hold IN "
+          "        SELECT h.hold_id, h.reader_id "
+          "        FROM holds h "
+          "        WHERE h.book_id = NEW.book_id AND h.status = 'waiting' "
+          "        ORDER BY h.hold_id "
+          "        LIMIT free "
+          "        FOR UPDATE SKIP LOCKED "
+          "    LOOP "
+          "        INSERT INTO loans (book_id, reader_id, loan_date) "
+          "        VALUES (NEW.book_id, next_hold.reader_id, CURRENT_DATE) "
+          "        RETURNING loan_id INTO new_loan; "
+          "        UPDATE holds "
+          "        SET status = 'fulfilled', loan_id = new_loan, closed_at = now() "
+          "        WHERE hold_id = next_hold.hold_id; "
+          "        free := free - 1; "
+          "    END LOOP; "
+          "    IF free < NEW.copies_available THEN "
+          "        UPDATE books SET copies_available = free WHERE book_id = NEW.book_id; "
+          "    END IF; "
+          "    RETURN NULL; "
+          "END; "
+          "$$ LANGUAGE plpgsql; "
+          "CREATE TRIGGER books_serve_holds AFTER UPDATE OF copies_available ON books "
+          "    FOR EACH ROW WHEN (NEW.copies_available > OLD.copies_available) "
+          "    EXECUTE FUNCTION serve_holds();" },
+    };
+    return list;
+}
+
+static bool exec(PGconn* conn, const std::string& sql, const char* what) {
+    PGresult* res = PQexec(conn, sql.c_str());
+    ExecStatusType status = PQresultStatus(res);
+    bool ok = (status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK);
+    if (!ok) {
+        err() << "Ошибка (" << what << "): " << PQresultErrorMessage(res) << std::endl;
+    }
+    PQclear(res);
+    return ok;
+}
+
+// Ключ рекомендательной блокировки на время миграций
+static const char* const MIGRATION_LOCK = "4242001";
+
+bool applyMigrations(PGconn* conn) {
+    if (!exec(conn, std::string("SELECT pg_advisory_lock(") + MIGRATION_LOCK + ");",
+            "блокировка миграций")) {
+        return false;
+    }
+
+    bool ok = exec(conn,
+        "CREATE TABLE IF NOT EXISTS schema_migrations ("
+        "    version     INT PRIMARY KEY, "
+        "    description TEXT NOT NULL, "
+        "    applied_at  TIMESTAMPTZ NOT NULL DEFAULT now()"
+        ");", "таблица миграций");
+
+    int current = 0;
+    if (ok) {
+        PGresult* res = PQexec(conn,
+            "SELECT COALESCE(MAX(version), 0) FROM schema_migrations;");
+        if (PQresultStatus(res) == PGRES_TUPLES_OK) {
+            current = std::stoi(PQgetvalue(res, 0, 0));
+        }
+        else {
+            err() << "Ошибка чтения версии схемы: " << PQresultErrorMessage(res) << std::endl;
+            ok = false;
+        }
+        PQclear(res);
+    }
+
+    for (const auto& m : migrationList()) {
+        if (!ok) break;
+        if (m.version <= current) continue;
+
+        out() << "Миграция " << m.version << ": " << m.description << "\n";
+        std::string version = std::to_string(m.version);
+        const char* params[2] = { version.c_str(), m.description };
+
+        ok = exec(conn, "BEGIN;", "начало транзакции") &&
+            exec(conn, m.sql, "миграция");
+        if (ok) {
+            PGresult* res = PQexecParams(conn,
+                "INSERT INTO schema_migrations (version, description) "
+                "VALUES ($1::int, $2);", 2, nullptr, params, nullptr, nullptr, 0);
+            ok = (PQresultStatus(res) == PGRES_COMMAND_OK);
+            if (!ok) {
+                err() << "Ошибка записи версии: " << PQresultErrorMessage(res) << std::endl;
+            }
+            PQclear(res);
+        }
+        ok = ok && exec(conn, "COMMIT;", "фиксация");
+        if (!ok) exec(conn, "ROLLBACK;", "откат");
+    }
+
+    exec(conn, std::string("SELECT pg_advisory_unlock(") + MIGRATION_LOCK + ");",
+        "снятие блокировки миграций");
+    return ok;
+}
+
+// Большие таблицы: последовательное чтение любой из них считается регрессией
+static const char* const LARGE_TABLES[] = {
+    "books", "book_cards", "loans", "loans_archive", "readers"
+};
+
+// Параметры для EXPLAIN EXECUTE. Размер страницы (последний параметр
+// списков _next/_prev) — обычные 50 строк: с LIMIT 1 почти любой план
+// становится чтением индекса. Условия фильтра книг берутся из
+// filterSample, недостающие параметры (ключ страницы) равны 1.
+const char* const SAMPLE_PAGE_SIZE = "50";
+
+static const std::map<std::string, std::vector<std::string>> SAMPLE_PARAMS = {
+    { "loan_issue",       { "1", "1", "'2024-01-01'" } },
+    { "loans_return",     { "'{1,2,3}'", "'2024-01-01'" } },
+    { "reader_insert",    { "'x'", "'x'", "'x'" } },
+    { "book_upsert",      { "'x'", "1", "1", "1", "1", "2000", "300", "1" } },
+    { "author_insert",    { "'x'", "'x'" } },
+    { "genre_insert",     { "'x'" } },
+    { "publisher_insert", { "'x'", "'x'" } },
+    { "language_insert",  { "'x'" } },
+    { "books_search_next", { "'нетакогослова:*'" } },
+    { "books_search_prev", { "'нетакогослова:*'" } },
+    { "loans_archive_batch", { "30", "1000" } },
+};
+
+// Данные для проверки: размеры производных таблиц считаются от числа книг
+static std::string generateDataSql(int books) {
+    std::string n = std::to_string(books);
+    return
+        "INSERT INTO authors (name) "
+        "SELECT 'Автор ' || g FROM generate_series(1, GREATEST(" + n + " / 10, 1)) g; "
+        "INSERT INTO genres (name) "
+        "SELECT 'Жанр ' || g FROM generate_series(1, 50) g; "
+        "INSERT INTO publishers (name) "
+        "SELECT 'Издательство ' || g FROM generate_series(1, 200) g; "
+        "INSERT INTO languages (name) "
+        "SELECT 'Язык ' || g FROM generate_series(1, 20) g; "
+        "INSERT INTO books (title, author_id, genre_id, publisher_id, language_id, "
+        "                   year, pages, copies_total, copies_available) "
+        "SELECT 'Книга ' || g, "
+        "       (SELECT MAX(author_id) FROM authors) - g % GREATEST(" + n + " / 10, 1), "
+        "       (SELECT MAX(genre_id) FROM genres) - g % 50, "
+        "       (SELECT MAX(publisher_id) FROM publishers) - g % 200, "
+        "       (SELECT MAX(language_id) FROM languages) - g % 20, "
+        "       1800 + g % 225, 50 + g % 1950, 3, g % 4 "
+        "FROM generate_series(1, " + n + ") g; "
+        "INSERT INTO readers (full_name) "
+        "SELECT 'Читатель ' || g FROM generate_series(1, GREATEST(" + n + " / 2, 1)) g; "
+        "INSERT INTO loans (book_id, reader_id, loan_date, return_date) "
+        "SELECT (SELECT MAX(book_id) FROM books) - g % " + n + ", "
+        "       (SELECT MAX(reader_id) FROM readers) - g % GREATEST(" + n + " / 2, 1), "
+        "       DATE '2020-01-01' + g % 1500, "
+        "       CASE WHEN g % 20 = 0 THEN NULL "
+        "            ELSE DATE '2020-01-01' + g % 1500 + 14 END "
+        "FROM generate_series(1, " + n + " * 2) g; "
+        "ANALYZE authors, genres, publishers, languages, books, book_cards, readers, loans;";
+}
+
+static bool endsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() &&
+        s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Условия фильтра книг на проверочных данных: около 2% книг по году
+// и по страницам, 10 книг автора, 2% жанра, 0,5% издательства, 5% языка.
+// Справочники проверочных данных добавляются последними, их ID — наибольшие.
+static BookFilter filterSample(PGconn* conn) {
+    BookFilter f;
+    f.yearFrom = 2000;
+    f.yearTo = 2004;
+    f.pagesFrom = 300;
+    f.pagesTo = 340;
+    PGresult* res = PQexec(conn,
+        "SELECT (SELECT MAX(author_id) FROM authors), "
+        "       (SELECT MAX(genre_id) FROM genres), "
+        "       (SELECT MAX(publisher_id) FROM publishers), "
+        "       (SELECT MAX(language_id) FROM languages);");
+    if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) == 1) {
+        f.authorId = std::atoi(PQgetvalue(res, 0, 0));
+        f.genreId = std::atoi(PQgetvalue(res, 0, 1));
+        f.publisherId = std::atoi(PQgetvalue(res, 0, 2));
+        f.languageId = std::atoi(PQgetvalue(res, 0, 3));
+    }
+    else {
+        f.authorId = f.genreId = f.publisherId = f.languageId = 1;
+    }
+    PQclear(res);
+    return f;
+}
+
+static std::string explainStatement(const PreparedStatement& st, const BookFilter& filter) {
+    std::string sql = "EXPLAIN EXECUTE " + st.name;
+    if (st.nParams == 0) return sql + ";";
+
+    auto sample = SAMPLE_PARAMS.find(st.name);
+    std::vector<std::string> params = (sample != SAMPLE_PARAMS.end())
+        ? sample->second : bookFilterParams(st.name, filter);
+    params.resize(st.nParams, "1");
+    bool paged = endsWith(st.name, "_next") || endsWith(st.name, "_prev");
+    bool limitGiven = (sample != SAMPLE_PARAMS.end() &&
+        sample->second.size() == static_cast<size_t>(st.nParams));
+    if (paged && !limitGiven) params.back() = SAMPLE_PAGE_SIZE;
+
+    sql += " (";
+    for (int i = 0; i < st.nParams; ++i) {
+        if (i > 0) sql += ", ";
+        sql += params[i];
+    }
+    return sql + ");";
+}
+
+bool checkPlans(PGconn* conn, int books) {
+    if (!exec(conn, "BEGIN;", "начало транзакции")) return false;
+
+    out() << "Генерация данных: " << books << " книг...\n";
+    if (!exec(conn, generateDataSql(books), "генерация данных")) {
+        exec(conn, "ROLLBACK;", "откат");
+        return false;
+    }
+
+    // Запросы фильтра книг не готовятся при подключении: готовим формы
+    // с каждым условием по отдельности и со всеми сразу
+    std::vector<PreparedStatement> statements = statementRegistry();
+    for (const auto& st : bookFilterStatements()) {
+        if (!prepareStatement(conn, st)) {
+            exec(conn, "ROLLBACK;", "откат");
+            return false;
+        }
+        statements.push_back(st);
+    }
+
+    BookFilter filter = filterSample(conn);
+    int failed = 0;
+    for (const auto& st : statements) {
+        PGresult* res = PQexec(conn, explainStatement(st, filter).c_str());
+        if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+            out() << "ОШИБКА  " << st.name << ": " << PQresultErrorMessage(res);
+            PQclear(res);
+            ++failed;
+            break;  // транзакция прервана, дальше проверять нечего
+        }
+
+        std::string problem;
+        for (int i = 0; i < PQntuples(res) && problem.empty(); ++i) {
+            std::string line = PQgetvalue(res, i, 0);
+            for (const char* table : LARGE_TABLES) {
+                // За именем таблицы в плане всегда идёт псевдоним или стоимость
+                std::string scan = std::string("Seq Scan on ") + table + " ";
+                if (line.find(scan) != std::string::npos) problem = line;
+            }
+        }
+        PQclear(res);
+
+        if (problem.empty()) {
+            out() << "OK      " << st.name << "\n";
+        }
+        else {
+            out() << "SEQSCAN " << st.name << ":" << problem << "\n";
+            ++failed;
+        }
+    }
+
+    exec(conn, "ROLLBACK;", "откат");
+    out() << (failed == 0 ? "Все планы используют индексы.\n"
+                          : "Запросов с последовательным чтением: " + std::to_string(failed) + "\n");
+    return failed == 0;
+}
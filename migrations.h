@@ -0,0 +1,20 @@
+#pragma once
+#include <libpq-fe.h>
+
+// Версионированные изменения схемы поверх library.sql. Применённые версии
+// записываются в schema_migrations; каждая миграция идёт в своей транзакции.
+struct Migration {
+    int version;
+    const char* description;
+    const char* sql;
+};
+
+// Применяет недостающие миграции по порядку; одновременный запуск
+// нескольких экземпляров разводится рекомендательной блокировкой
+bool applyMigrations(PGconn* conn);
+
+// Проверка планов: в откатываемой транзакции создаёт books книг (и
+// пропорционально авторов, читателей, выдач), выполняет EXPLAIN для каждого
+// подготовленного запроса и сообщает о последовательном чтении больших
+// таблиц. Возвращает false, если такие запросы есть.
+bool checkPlans(PGconn* conn, int books);
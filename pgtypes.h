@@ -0,0 +1,262 @@
+#pragma once
+#include <libpq-fe.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Типизированные параметры и результаты запросов. Целые параметры
+// передаются серверу в двоичном виде, а результаты внутренних запросов
+// (ID, счётчики, флаги) запрашиваются в двоичном формате и читаются без
+// разбора текста. Для печати таблиц результаты по-прежнему текстовые.
+
+// OID встроенных типов PostgreSQL
+const Oid BOOL_OID = 16;
+const Oid NAME_OID = 19;
+const Oid INT8_OID = 20;
+const Oid INT2_OID = 21;
+const Oid INT4_OID = 23;
+const Oid TEXT_OID = 25;
+const Oid FLOAT4_OID = 700;
+const Oid FLOAT8_OID = 701;
+const Oid BPCHAR_OID = 1042;
+const Oid VARCHAR_OID = 1043;
+const Oid DATE_OID = 1082;
+const Oid NUMERIC_OID = 1700;
+
+const int TEXT_FORMAT = 0;
+const int BINARY_FORMAT = 1;
+
+// Целое без исключений: false, если строка не число или не влезает в int32
+inline bool parseInt32(const std::string& s, int32_t& value) {
+    if (s.empty() || s.size() > 11) return false;
+    char* end = nullptr;
+    errno = 0;
+    long long v = std::strtoll(s.c_str(), &end, 10);
+    if (errno != 0 || *end != '\0' || v < INT32_MIN || v > INT32_MAX) return false;
+    value = static_cast<int32_t>(v);
+    return true;
+}
+
+// Порядок байт сети (big-endian), как в двоичном протоколе
+inline void putBigEndian(std::string& out, uint64_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; --i) out += static_cast<char>((v >> (8 * i)) & 0xFF);
+}
+
+inline uint64_t getBigEndian(const char* p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i) v = (v << 8) | static_cast<unsigned char>(p[i]);
+    return v;
+}
+
+// Параметры запроса: целые и массивы целых в двоичном виде, строки текстом
+class QueryParams {
+public:
+    QueryParams& add(int32_t v) {
+        std::string bytes;
+        putBigEndian(bytes, static_cast<uint32_t>(v), 4);
+        return push(bytes, BINARY_FORMAT);
+    }
+
+    QueryParams& add(int64_t v) {
+        std::string bytes;
+        putBigEndian(bytes, static_cast<uint64_t>(v), 8);
+        return push(bytes, BINARY_FORMAT);
+    }
+
+    // Одномерный массив int4[] в двоичном формате массивов PostgreSQL
+    QueryParams& add(const std::vector<int32_t>& v) {
+        std::string bytes;
+        putBigEndian(bytes, 1, 4);              // число измерений
+        putBigEndian(bytes, 0, 4);              // флаг NULL-элементов
+        putBigEndian(bytes, INT4_OID, 4);       // тип элементов
+        putBigEndian(bytes, v.size(), 4);       // длина измерения
+        putBigEndian(bytes, 1, 4);              // нижняя граница
+        for (int32_t x : v) {
+            putBigEndian(bytes, 4, 4);
+            putBigEndian(bytes, static_cast<uint32_t>(x), 4);
+        }
+        return push(bytes, BINARY_FORMAT);
+    }
+
+    QueryParams& add(const std::string& v) {
+        return push(v, TEXT_FORMAT);
+    }
+
+    int size() const { return static_cast<int>(data.size()); }
+
+    const char* const* values() const {
+        pointers.clear();
+        for (const auto& d : data) pointers.push_back(d.c_str());
+        return pointers.data();
+    }
+
+    const int* lengths() const { return sizes.data(); }
+    const int* formats() const { return kinds.data(); }
+
+private:
+    QueryParams& push(const std::string& bytes, int format) {
+        data.push_back(bytes);
+        sizes.push_back(static_cast<int>(bytes.size()));
+        kinds.push_back(format);
+        return *this;
+    }
+
+    std::vector<std::string> data;
+    std::vector<int> sizes;
+    std::vector<int> kinds;
+    mutable std::vector<const char*> pointers;
+};
+
+// Дни от 2000-01-01 (так даты хранятся в двоичном формате) в год, месяц
+// и день. Алгоритм civil_from_days, отсчёт от 0000-03-01.
+inline void civilFromDays(int32_t days, long long& y, int& m, int& d) {
+    long long z = static_cast<long long>(days) + 10957 + 719468;
+    long long era = (z >= 0 ? z : z - 146096) / 146097;
+    long long doe = z - era * 146097;
+    long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    long long mp = (5 * doy + 2) / 153;
+    y = yoe + era * 400;
+    d = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+    m = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+    if (m <= 2) ++y;
+}
+
+// Обратное преобразование: алгоритм days_from_civil
+inline int32_t daysFromCivil(long long y, int m, int d) {
+    y -= (m <= 2);
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    long long yoe = y - era * 400;
+    long long doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return static_cast<int32_t>(era * 146097 + doe - 719468 - 10957);
+}
+
+// Дата из двоичного формата в виде YYYY-MM-DD
+inline std::string formatPgDate(int32_t days) {
+    if (days == INT32_MAX) return "infinity";
+    if (days == INT32_MIN) return "-infinity";
+    long long y;
+    int m, d;
+    civilFromDays(days, y, m, d);
+    char buf[48];
+    std::snprintf(buf, sizeof(buf), "%04lld-%02d-%02d", y, m, d);
+    return buf;
+}
+
+// Дата YYYY-MM-DD в дни от 2000-01-01; false, если дата некорректна
+inline bool parsePgDate(const std::string& s, int32_t& days) {
+    int y, m, d;
+    char tail;
+    if (std::sscanf(s.c_str(), "%4d-%2d-%2d%c", &y, &m, &d, &tail) != 3 ||
+        m < 1 || m > 12 || d < 1) {
+        return false;
+    }
+    static const int MONTH_DAYS[] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+    if (d > MONTH_DAYS[m - 1] || (m == 2 && d == 29 && !leap)) return false;
+    days = daysFromCivil(y, m, d);
+    return true;
+}
+
+// Значение столбца как целое: int2, int4 и int8 в двоичном или текстовом виде
+inline bool readInteger(const PGresult* res, int row, int col, int64_t& value) {
+    if (PQgetisnull(res, row, col)) return false;
+    const char* p = PQgetvalue(res, row, col);
+    if (PQfformat(res, col) == TEXT_FORMAT) {
+        char* end = nullptr;
+        errno = 0;
+        value = std::strtoll(p, &end, 10);
+        return errno == 0 && end != p && *end == '\0';
+    }
+    switch (PQftype(res, col)) {
+    case INT2_OID: value = static_cast<int16_t>(getBigEndian(p, 2)); return true;
+    case INT4_OID: value = static_cast<int32_t>(getBigEndian(p, 4)); return true;
+    case INT8_OID: value = static_cast<int64_t>(getBigEndian(p, 8)); return true;
+    default:       return false;
+    }
+}
+
+// Чтение столбца в переменную C++; false для NULL и несовместимого типа
+inline bool readValue(const PGresult* res, int row, int col, int64_t& value) {
+    return readInteger(res, row, col, value);
+}
+
+inline bool readValue(const PGresult* res, int row, int col, int32_t& value) {
+    int64_t v;
+    if (!readInteger(res, row, col, v) || v < INT32_MIN || v > INT32_MAX) return false;
+    value = static_cast<int32_t>(v);
+    return true;
+}
+
+inline bool readValue(const PGresult* res, int row, int col, bool& value) {
+    if (PQgetisnull(res, row, col) || PQftype(res, col) != BOOL_OID) return false;
+    const char* p = PQgetvalue(res, row, col);
+    value = (PQfformat(res, col) == TEXT_FORMAT) ? (p[0] == 't') : (p[0] != 0);
+    return true;
+}
+
+// Строка: текстовые типы как есть, целые, флаги и даты — в обычном виде.
+// Прочие типы в двоичном формате (numeric, timestamp, ...) не читаются:
+// их байты не текст.
+inline bool readValue(const PGresult* res, int row, int col, std::string& value) {
+    if (PQgetisnull(res, row, col)) return false;
+    const char* p = PQgetvalue(res, row, col);
+    if (PQfformat(res, col) == TEXT_FORMAT) {
+        value.assign(p, PQgetlength(res, row, col));
+        return true;
+    }
+    switch (PQftype(res, col)) {
+    case INT2_OID:
+    case INT4_OID:
+    case INT8_OID: {
+        int64_t v;
+        if (!readInteger(res, row, col, v)) return false;
+        value = std::to_string(v);
+        return true;
+    }
+    case BOOL_OID:
+        value = p[0] ? "t" : "f";
+        return true;
+    case DATE_OID:
+        value = formatPgDate(static_cast<int32_t>(getBigEndian(p, 4)));
+        return true;
+    case TEXT_OID:
+    case VARCHAR_OID:
+    case BPCHAR_OID:
+    case NAME_OID:
+        // Двоичный формат текстовых типов совпадает с текстом
+        value.assign(p, PQgetlength(res, row, col));
+        return true;
+    default:
+        return false;
+    }
+}
+
+// NULL читается как пустое значение
+template <class T>
+bool readValue(const PGresult* res, int row, int col, std::optional<T>& value) {
+    if (PQgetisnull(res, row, col)) {
+        value.reset();
+        return true;
+    }
+    T v;
+    if (!readValue(res, row, col, v)) return false;
+    value = v;
+    return true;
+}
+
+// Строка результата по столбцам в порядке аргументов:
+// readRow(res, 0, status, loanId) читает столбцы 0 и 1
+template <class... T>
+bool readRow(const PGresult* res, int row, T&... values) {
+    if (row >= PQntuples(res) || PQnfields(res) < static_cast<int>(sizeof...(T))) return false;
+    int col = 0;
+    bool ok = true;
+    ((ok = ok && readValue(res, row, col++, values)), ...);
+    return ok;
+}
@@ -0,0 +1,78 @@
+#include "pool.h"
+#include "database.h"
+#include "refcache.h"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+static const char* const DEFAULT_CONNINFO =
+    "host=localhost port=5432 dbname=library user=postgres";
+
+std::string loadConnInfo() {
+    if (const char* dsn = std::getenv("LIBRARY_DSN")) {
+        if (*dsn != '\0') return dsn;
+    }
+
+    const char* confPath = std::getenv("LIBRARY_CONF");
+    std::ifstream conf(confPath != nullptr ? confPath : "library.conf");
+    if (conf) {
+        // Строки файла складываются в одну строку подключения libpq,
+        // комментарии начинаются с #
+        std::string line, connInfo;
+        while (std::getline(conf, line)) {
+            size_t hash = line.find('#');
+            if (hash != std::string::npos) line.erase(hash);
+            if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+            if (!connInfo.empty()) connInfo += ' ';
+            connInfo += line;
+        }
+        if (!connInfo.empty()) return connInfo;
+    }
+
+    return DEFAULT_CONNINFO;
+}
+
+PGconn* openConnection(const std::string& connInfo) {
+    PGconn* conn = PQconnectdb(connInfo.c_str());
+    if (PQstatus(conn) != CONNECTION_OK) {
+        std::cerr << "Ошибка подключения: " << PQerrorMessage(conn) << std::endl;
+        PQfinish(conn);
+        return nullptr;
+    }
+    prepareStatements(conn);
+    ReferenceCache::instance().attach(conn);
+    return conn;
+}
+
+ConnectionPool::ConnectionPool(const std::string& connInfo, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        PGconn* conn = openConnection(connInfo);
+        if (conn == nullptr) {
+            for (PGconn* c : all) PQfinish(c);
+            throw std::runtime_error("не удалось создать пул подключений");
+        }
+        all.push_back(conn);
+    }
+    idle = all;
+}
+
+ConnectionPool::~ConnectionPool() {
+    for (PGconn* conn : all) PQfinish(conn);
+}
+
+PGconn* ConnectionPool::acquire() {
+    std::unique_lock<std::mutex> lock(mutex);
+    available.wait(lock, [this] { return !idle.empty(); });
+    PGconn* conn = idle.back();
+    idle.pop_back();
+    return conn;
+}
+
+void ConnectionPool::release(PGconn* conn) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        idle.push_back(conn);
+    }
+    available.notify_one();
+}
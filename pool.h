@@ -0,0 +1,50 @@
+#pragma once
+#include <libpq-fe.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Параметры подключения: переменная окружения LIBRARY_DSN, затем файл
+// из LIBRARY_CONF (по умолчанию library.conf), затем значения по умолчанию.
+// Пароль в исходниках не хранится: libpq берёт его из PGPASSWORD или ~/.pgpass.
+std::string loadConnInfo();
+
+// Подключение с подготовкой запросов; nullptr, если подключиться не удалось
+PGconn* openConnection(const std::string& connInfo);
+
+// Пул подключений, общий для рабочих потоков
+class ConnectionPool {
+public:
+    ConnectionPool(const std::string& connInfo, size_t size);
+    ~ConnectionPool();
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    // Ждёт свободное подключение
+    PGconn* acquire();
+    void release(PGconn* conn);
+
+    size_t size() const { return all.size(); }
+
+private:
+    std::mutex mutex;
+    std::condition_variable available;
+    std::vector<PGconn*> idle;
+    std::vector<PGconn*> all;
+};
+
+// Подключение из пула на время жизни объекта
+class PooledConnection {
+public:
+    explicit PooledConnection(ConnectionPool& pool) : pool(pool), conn(pool.acquire()) {}
+    ~PooledConnection() { pool.release(conn); }
+    PooledConnection(const PooledConnection&) = delete;
+    PooledConnection& operator=(const PooledConnection&) = delete;
+
+    PGconn* get() const { return conn; }
+
+private:
+    ConnectionPool& pool;
+    PGconn* conn;
+};
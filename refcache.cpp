@@ -0,0 +1,258 @@
+#include "refcache.h"
+#include "database.h"
+#include "pgtypes.h"
+#include <cstdlib>
+#include <mutex>
+#include <ostream>
+#include <set>
+
+// Справочники и их ключевые столбцы
+static const char* const CACHED_TABLES[][2] = {
+    { "authors",    "author_id" },
+    { "genres",     "genre_id" },
+    { "publishers", "publisher_id" },
+    { "languages",  "language_id" },
+};
+
+// Приведение к нижнему регистру для латиницы, Latin-1 и кириллицы,
+// чтобы поиск по названию совпадал с прежним ILIKE
+static std::string foldCase(const std::string& s) {
+    std::string r;
+    r.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if (c >= 'A' && c <= 'Z') {
+            r += static_cast<char>(c + ('a' - 'A'));
+            continue;
+        }
+        if (i + 1 < s.size()) {
+            unsigned char d = static_cast<unsigned char>(s[i + 1]);
+            if (c == 0xD0 && d >= 0x90 && d <= 0x9F) {        // А..П
+                r += static_cast<char>(0xD0);
+                r += static_cast<char>(d + 0x20);
+                ++i;
+                continue;
+            }
+            if (c == 0xD0 && d >= 0xA0 && d <= 0xAF) {        // Р..Я
+                r += static_cast<char>(0xD1);
+                r += static_cast<char>(d - 0x20);
+                ++i;
+                continue;
+            }
+            if (c == 0xD0 && d >= 0x80 && d <= 0x8F) {        // Ѐ..Џ, в т.ч. Ё
+                r += static_cast<char>(0xD1);
+                r += static_cast<char>(d + 0x10);
+                ++i;
+                continue;
+            }
+            if (c == 0xC3 && d >= 0x80 && d <= 0x9E && d != 0x97) {  // À..Þ
+                r += static_cast<char>(0xC3);
+                r += static_cast<char>(d + 0x20);
+                ++i;
+                continue;
+            }
+        }
+        r += static_cast<char>(c);
+    }
+    return r;
+}
+
+ReferenceCache& ReferenceCache::instance() {
+    static ReferenceCache cache;
+    return cache;
+}
+
+bool ReferenceCache::listen(PGconn* conn) {
+    PGresult* res = PQexec(conn, "LISTEN reference_changed;");
+    bool ok = (PQresultStatus(res) == PGRES_COMMAND_OK);
+    if (!ok) {
+        err() << "Ошибка подписки на изменения справочников: "
+            << PQresultErrorMessage(res) << std::endl;
+    }
+    PQclear(res);
+    if (ok) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        listeners[conn] = PQbackendPID(conn);
+    }
+    return ok;
+}
+
+bool ReferenceCache::read(PGconn* conn, const char* table, const char* idColumn,
+    const std::set<int>* ids, std::map<int, Entry>& rows) {
+    std::string query = std::string("SELECT ") + idColumn + ", name FROM " + table;
+    std::string idList;
+    PGresult* res;
+    if (ids == nullptr) {
+        res = PQexec(conn, query.c_str());
+    }
+    else {
+        // Массив ID одним параметром в текстовом виде: {1,2,3}
+        idList = "{";
+        for (int id : *ids) {
+            if (idList.size() > 1) idList += ',';
+            idList += std::to_string(id);
+        }
+        idList += '}';
+        query += std::string(" WHERE ") + idColumn + " = ANY($1::int[])";
+        const char* params[] = { idList.c_str() };
+        res = PQexecParams(conn, query.c_str(), 1, nullptr, params, nullptr, nullptr, 0);
+    }
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        err() << "Ошибка загрузки справочника " << table << ": "
+            << PQresultErrorMessage(res) << std::endl;
+        PQclear(res);
+        return false;
+    }
+    rows.clear();
+    for (int i = 0; i < PQntuples(res); ++i) {
+        std::string name = PQgetvalue(res, i, 1);
+        rows[std::atoi(PQgetvalue(res, i, 0))] = { name, foldCase(name) };
+    }
+    PQclear(res);
+    return true;
+}
+
+void ReferenceCache::apply(Table& t, uint64_t version, const std::set<int>* ids,
+    const std::map<int, Entry>& rows) {
+    if (version <= t.version) return;
+
+    auto newer = [&t, version](int id) {
+        auto v = t.versions.find(id);
+        return v != t.versions.end() && v->second >= version;
+    };
+
+    if (ids != nullptr) {
+        for (int id : *ids) {
+            if (newer(id)) continue;
+            auto row = rows.find(id);
+            if (row != rows.end()) t.rows[id] = row->second;
+            else t.rows.erase(id);
+            t.versions[id] = version;
+        }
+        return;
+    }
+
+    for (auto e = t.rows.begin(); e != t.rows.end();) {
+        if (!rows.count(e->first) && !newer(e->first)) e = t.rows.erase(e);
+        else ++e;
+    }
+    for (const auto& row : rows) {
+        if (!newer(row.first)) t.rows[row.first] = row.second;
+    }
+    // Записи, прочитанные раньше этого чтения, им покрыты
+    t.version = version;
+    for (auto v = t.versions.begin(); v != t.versions.end();) {
+        if (v->second <= version) v = t.versions.erase(v);
+        else ++v;
+    }
+}
+
+bool ReferenceCache::load(PGconn* conn) {
+    for (const auto& t : CACHED_TABLES) {
+        uint64_t version = ++reads;
+        std::map<int, Entry> rows;
+        if (!read(conn, t[0], t[1], nullptr, rows)) return false;
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        apply(tables[t[0]], version, nullptr, rows);
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    loaded = true;
+    return true;
+}
+
+bool ReferenceCache::attach(PGconn* conn) {
+    // Подписка до загрузки: изменения, сделанные во время загрузки,
+    // всё равно придут уведомлениями
+    if (!listen(conn)) return false;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        if (loaded) return true;
+    }
+    return load(conn);
+}
+
+void ReferenceCache::poll(PGconn* conn) {
+    bool attached;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto known = listeners.find(conn);
+        attached = (known != listeners.end() && known->second == PQbackendPID(conn));
+    }
+
+    if (!attached) {
+        // Новое или переподключённое подключение: уведомления могли
+        // потеряться, поэтому справочники читаются заново
+        if (listen(conn)) load(conn);
+        return;
+    }
+
+    // Подключение принадлежит вызывающему потоку, поэтому уведомления
+    // читаются без блокировки; кэш блокируется, только если они есть
+    PQconsumeInput(conn);
+    std::map<std::string, std::set<int>> changedIds;
+    std::set<std::string> truncated;
+    while (PGnotify* n = PQnotifies(conn)) {
+        // Формат: таблица|операция|id|название
+        std::string payload = n->extra;
+        PQfreemem(n);
+        size_t op = payload.find('|');
+        if (op == std::string::npos || op + 1 >= payload.size()) continue;
+        std::string table = payload.substr(0, op);
+        size_t idEnd = payload.find('|', op + 3);
+        int32_t id;
+        if (payload[op + 1] == 'T') {
+            truncated.insert(table);
+        }
+        else if (idEnd != std::string::npos &&
+            parseInt32(payload.substr(op + 3, idEnd - op - 3), id)) {
+            changedIds[table].insert(id);
+        }
+        else {
+            truncated.insert(table);
+        }
+    }
+    if (changedIds.empty() && truncated.empty()) return;
+
+    // Очередь уведомлений у каждого подключения пула своя, и отстающее
+    // подключение может принести изменения старше уже применённых другим.
+    // Поэтому название из уведомления не используется: записи перечитываются
+    // без блокировки кэша, и прочитанное применяется к записи, только если
+    // чтение начато позже применённого (номер чтения берётся до запроса).
+    for (const auto& t : CACHED_TABLES) {
+        bool whole = truncated.count(t[0]) > 0;
+        auto ids = changedIds.find(t[0]);
+        if (!whole && ids == changedIds.end()) continue;
+        const std::set<int>* only = whole ? nullptr : &ids->second;
+
+        uint64_t version = ++reads;
+        std::map<int, Entry> rows;
+        if (!read(conn, t[0], t[1], only, rows)) continue;
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        apply(tables[t[0]], version, only, rows);
+    }
+}
+
+bool ReferenceCache::findById(const std::string& table, int id, std::string& name) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto t = tables.find(table);
+    if (t == tables.end()) return false;
+    auto e = t->second.rows.find(id);
+    if (e == t->second.rows.end()) return false;
+    name = e->second.name;
+    return true;
+}
+
+std::vector<std::pair<int, std::string>> ReferenceCache::search(const std::string& table,
+    const std::string& needle) const {
+    std::vector<std::pair<int, std::string>> found;
+    std::string folded = foldCase(needle);
+
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto t = tables.find(table);
+    if (t == tables.end()) return found;
+    for (const auto& e : t->second.rows) {
+        if (e.second.folded.find(folded) != std::string::npos)
+            found.emplace_back(e.first, e.second.name);
+    }
+    return found;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <libpq-fe.h>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Кэш справочников (авторы, жанры, издательства, языки) в памяти процесса.
+// Загружается один раз; об изменениях сообщают уведомления LISTEN
+// reference_changed от триггеров (миграция 7), по ним перечитываются только
+// изменённые записи.
+class ReferenceCache {
+public:
+    static ReferenceCache& instance();
+
+    // Подписывает подключение на уведомления; при первом вызове загружает кэш
+    bool attach(PGconn* conn);
+
+    // Перечитывает записи, о смене которых пришли уведомления на
+    // подключение. Если подключение было восстановлено, подписывается
+    // заново и перезагружает кэш.
+    void poll(PGconn* conn);
+
+    bool findById(const std::string& table, int id, std::string& name) const;
+
+    // Поиск по части названия без учёта регистра, по возрастанию ID
+    std::vector<std::pair<int, std::string>> search(const std::string& table,
+        const std::string& needle) const;
+
+private:
+    struct Entry {
+        std::string name;
+        std::string folded;
+    };
+
+    // Записи справочника и номера чтений, по которым они получены: чтение
+    // применяется к записи, только если оно начато позже уже применённого
+    struct Table {
+        std::map<int, Entry> rows;
+        std::map<int, uint64_t> versions;
+        uint64_t version = 0;    // последнее чтение справочника целиком
+    };
+
+    ReferenceCache() = default;
+    bool listen(PGconn* conn);
+    bool load(PGconn* conn);
+    // Читает справочник целиком (ids == nullptr) или только записи ids;
+    // запрос идёт без блокировки кэша
+    bool read(PGconn* conn, const char* table, const char* idColumn,
+        const std::set<int>* ids, std::map<int, Entry>& rows);
+    // Под исключительной блокировкой
+    void apply(Table& t, uint64_t version, const std::set<int>* ids,
+        const std::map<int, Entry>& rows);
+
+    mutable std::shared_mutex mutex;
+    std::map<std::string, Table> tables;
+    std::map<PGconn*, int> listeners;
+    bool loaded = false;
+    std::atomic<uint64_t> reads{ 0 };
+};
@@ -0,0 +1,369 @@
+#include "render.h"
+#include "pgtypes.h"
+#include "textwidth.h"
+#include <cstring>
+
+static OutputFormat currentFormat = OutputFormat::Table;
+
+bool parseOutputFormat(const std::string& name, OutputFormat& format) {
+    static const struct {
+        const char* name;
+        OutputFormat format;
+    } formats[] = {
+        { "table",   OutputFormat::Table },
+        { "compact", OutputFormat::Compact },
+        { "tsv",     OutputFormat::Tsv },
+        { "csv",     OutputFormat::Csv },
+        { "jsonl",   OutputFormat::Jsonl },
+    };
+    for (const auto& f : formats) {
+        if (name == f.name) {
+            format = f.format;
+            return true;
+        }
+    }
+    return false;
+}
+
+void setOutputFormat(OutputFormat format) {
+    currentFormat = format;
+}
+
+OutputFormat outputFormat() {
+    return currentFormat;
+}
+
+OutputBuffer::OutputBuffer(std::ostream& os) : os(os) {
+    data.reserve(FLUSH_SIZE + 4096);
+}
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+}
+
+void OutputBuffer::flush() {
+    if (data.empty()) return;
+    os.write(data.data(), static_cast<std::streamsize>(data.size()));
+    os.flush();
+    data.clear();
+}
+
+std::vector<int> headerWidths(const PGresult* res) {
+    int cols = PQnfields(res);
+    std::vector<int> widths(cols, 0);
+    for (int j = 0; j < cols; ++j) {
+        const char* name = PQfname(res, j);
+        widths[j] = displayWidth(name, std::strlen(name));
+    }
+    return widths;
+}
+
+void widenToRow(std::vector<int>& widths, const PGresult* res, int row) {
+    for (size_t j = 0; j < widths.size(); ++j) {
+        int col = static_cast<int>(j);
+        int len = displayWidth(PQgetvalue(res, row, col), PQgetlength(res, row, col));
+        if (len > widths[j]) widths[j] = len;
+    }
+}
+
+// Таблица с рамками; ячейка — «| », значение и отступ до ширины столбца
+// плюс два знакоместа
+class TableRenderer : public ResultRenderer {
+public:
+    bool needsWidths() const override { return true; }
+
+    void commandOk(OutputBuffer& buf) const override {
+        static const char message[] = "Операция выполнена успешно.\n";
+        buf.append(message, sizeof(message) - 1);
+    }
+
+    void begin(OutputBuffer& buf, const PGresult* res,
+        const std::vector<int>& widths) const override {
+        buf.append('\n');
+        divider(buf, widths);
+        for (size_t j = 0; j < widths.size(); ++j) {
+            const char* name = PQfname(res, static_cast<int>(j));
+            cell(buf, name, std::strlen(name), widths[j]);
+        }
+        buf.append("|\n", 2);
+        divider(buf, widths);
+    }
+
+    void row(OutputBuffer& buf, const PGresult* res, int row,
+        const std::vector<int>& widths) const override {
+        for (size_t j = 0; j < widths.size(); ++j) {
+            int col = static_cast<int>(j);
+            cell(buf, PQgetvalue(res, row, col), PQgetlength(res, row, col), widths[j]);
+        }
+        buf.append("|\n", 2);
+    }
+
+    void end(OutputBuffer& buf, const std::vector<int>& widths) const override {
+        divider(buf, widths);
+        buf.append('\n');
+    }
+
+private:
+    static void cell(OutputBuffer& buf, const char* value, size_t len, int width) {
+        buf.append("| ", 2);
+        buf.append(value, len);
+        buf.fill(' ', width + 2 - displayWidth(value, len));
+    }
+
+    static void divider(OutputBuffer& buf, const std::vector<int>& widths) {
+        buf.append('+');
+        for (size_t j = 0; j < widths.size(); ++j) {
+            buf.fill('-', widths[j] + 3);
+            if (j + 1 < widths.size()) buf.append('+');
+        }
+        buf.append("+\n", 2);
+    }
+};
+
+// Выровненные столбцы без рамок, через два пробела; последний столбец
+// не дополняется пробелами
+class CompactRenderer : public ResultRenderer {
+public:
+    bool needsWidths() const override { return true; }
+
+    void commandOk(OutputBuffer& buf) const override {
+        static const char message[] = "Операция выполнена успешно.\n";
+        buf.append(message, sizeof(message) - 1);
+    }
+
+    void begin(OutputBuffer& buf, const PGresult* res,
+        const std::vector<int>& widths) const override {
+        for (size_t j = 0; j < widths.size(); ++j) {
+            const char* name = PQfname(res, static_cast<int>(j));
+            cell(buf, name, std::strlen(name), widths, j);
+        }
+        buf.append('\n');
+    }
+
+    void row(OutputBuffer& buf, const PGresult* res, int row,
+        const std::vector<int>& widths) const override {
+        for (size_t j = 0; j < widths.size(); ++j) {
+            int col = static_cast<int>(j);
+            cell(buf, PQgetvalue(res, row, col), PQgetlength(res, row, col), widths, j);
+        }
+        buf.append('\n');
+    }
+
+    void end(OutputBuffer&, const std::vector<int>&) const override {}
+
+private:
+    static void cell(OutputBuffer& buf, const char* value, size_t len,
+        const std::vector<int>& widths, size_t j) {
+        if (j > 0) buf.append("  ", 2);
+        buf.append(value, len);
+        if (j + 1 < widths.size()) buf.fill(' ', widths[j] - displayWidth(value, len));
+    }
+};
+
+// Поля через табуляцию; табуляция, перевод строки и обратная косая черта
+// экранируются, как в COPY text, NULL выводится как \N. Сообщений об успехе
+// нет — формат для сценариев.
+class TsvRenderer : public ResultRenderer {
+public:
+    void begin(OutputBuffer& buf, const PGresult* res,
+        const std::vector<int>&) const override {
+        for (int j = 0; j < PQnfields(res); ++j) {
+            if (j > 0) buf.append('\t');
+            const char* name = PQfname(res, j);
+            field(buf, name, std::strlen(name));
+        }
+        buf.append('\n');
+    }
+
+    void row(OutputBuffer& buf, const PGresult* res, int row,
+        const std::vector<int>&) const override {
+        for (int j = 0; j < PQnfields(res); ++j) {
+            if (j > 0) buf.append('\t');
+            if (PQgetisnull(res, row, j)) buf.append("\\N", 2);
+            else field(buf, PQgetvalue(res, row, j), PQgetlength(res, row, j));
+        }
+        buf.append('\n');
+    }
+
+    void end(OutputBuffer&, const std::vector<int>&) const override {}
+
+private:
+    static void field(OutputBuffer& buf, const char* value, size_t len) {
+        const char* end = value + len;
+        const char* plain = value;
+        for (const char* p = value; p < end; ++p) {
+            const char* escape = nullptr;
+            switch (*p) {
+            case '\\': escape = "\\\\"; break;
+            case '\t': escape = "\\t";  break;
+            case '\n': escape = "\\n";  break;
+            case '\r': escape = "\\r";  break;
+            default: continue;
+            }
+            buf.append(plain, p - plain);
+            buf.append(escape, 2);
+            plain = p + 1;
+        }
+        buf.append(plain, end - plain);
+    }
+};
+
+// CSV по RFC 4180: поле в кавычках, если в нём есть разделитель, кавычка
+// или перевод строки; кавычки внутри удваиваются. Как в COPY csv, NULL —
+// пустое поле без кавычек, а пустая строка — "".
+class CsvRenderer : public ResultRenderer {
+public:
+    void begin(OutputBuffer& buf, const PGresult* res,
+        const std::vector<int>&) const override {
+        for (int j = 0; j < PQnfields(res); ++j) {
+            if (j > 0) buf.append(',');
+            const char* name = PQfname(res, j);
+            field(buf, name, std::strlen(name));
+        }
+        buf.append('\n');
+    }
+
+    void row(OutputBuffer& buf, const PGresult* res, int row,
+        const std::vector<int>&) const override {
+        for (int j = 0; j < PQnfields(res); ++j) {
+            if (j > 0) buf.append(',');
+            if (PQgetisnull(res, row, j)) continue;
+            field(buf, PQgetvalue(res, row, j), PQgetlength(res, row, j));
+        }
+        buf.append('\n');
+    }
+
+    void end(OutputBuffer&, const std::vector<int>&) const override {}
+
+private:
+    static void field(OutputBuffer& buf, const char* value, size_t len) {
+        const char* end = value + len;
+        bool quote = (len == 0);
+        for (const char* p = value; p < end && !quote; ++p) {
+            quote = (*p == ',' || *p == '"' || *p == '\n' || *p == '\r');
+        }
+        if (!quote) {
+            buf.append(value, len);
+            return;
+        }
+        buf.append('"');
+        const char* plain = value;
+        for (const char* p = value; p < end; ++p) {
+            if (*p != '"') continue;
+            buf.append(plain, p - plain + 1);
+            buf.append('"');
+            plain = p + 1;
+        }
+        buf.append(plain, end - plain);
+        buf.append('"');
+    }
+};
+
+// Объект JSON на строку: имена столбцов — ключи, NULL — null, числа
+// и логические значения — без кавычек
+class JsonlRenderer : public ResultRenderer {
+public:
+    void begin(OutputBuffer&, const PGresult*, const std::vector<int>&) const override {}
+
+    void row(OutputBuffer& buf, const PGresult* res, int row,
+        const std::vector<int>&) const override {
+        buf.append('{');
+        for (int j = 0; j < PQnfields(res); ++j) {
+            if (j > 0) buf.append(',');
+            const char* name = PQfname(res, j);
+            string(buf, name, std::strlen(name));
+            buf.append(':');
+            value(buf, res, row, j);
+        }
+        buf.append("}\n", 2);
+    }
+
+    void end(OutputBuffer&, const std::vector<int>&) const override {}
+
+private:
+    static void value(OutputBuffer& buf, const PGresult* res, int row, int col) {
+        if (PQgetisnull(res, row, col)) {
+            buf.append("null", 4);
+            return;
+        }
+        const char* v = PQgetvalue(res, row, col);
+        size_t len = PQgetlength(res, row, col);
+        switch (PQftype(res, col)) {
+        case BOOL_OID:
+            if (*v == 't') buf.append("true", 4);
+            else buf.append("false", 5);
+            return;
+        case INT2_OID:
+        case INT4_OID:
+        case INT8_OID:
+            buf.append(v, len);
+            return;
+        case FLOAT4_OID:
+        case FLOAT8_OID:
+        case NUMERIC_OID:
+            // NaN и Infinity числами в JSON не записать
+            if (len > 0 && std::strpbrk(v, "NI") == nullptr) {
+                buf.append(v, len);
+                return;
+            }
+            break;
+        default:
+            break;
+        }
+        string(buf, v, len);
+    }
+
+    static void string(OutputBuffer& buf, const char* s, size_t len) {
+        static const char hex[] = "0123456789abcdef";
+        buf.append('"');
+        const char* end = s + len;
+        const char* plain = s;
+        for (const char* p = s; p < end; ++p) {
+            unsigned char c = static_cast<unsigned char>(*p);
+            if (c >= 0x20 && c != '"' && c != '\\') continue;
+            buf.append(plain, p - plain);
+            switch (c) {
+            case '"':  buf.append("\\\"", 2); break;
+            case '\\': buf.append("\\\\", 2); break;
+            case '\n': buf.append("\\n", 2);  break;
+            case '\r': buf.append("\\r", 2);  break;
+            case '\t': buf.append("\\t", 2);  break;
+            default: {
+                char escape[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+                buf.append(escape, sizeof(escape));
+            }
+            }
+            plain = p + 1;
+        }
+        buf.append(plain, end - plain);
+        buf.append('"');
+    }
+};
+
+const ResultRenderer& rendererFor(OutputFormat format) {
+    static const TableRenderer table;
+    static const CompactRenderer compact;
+    static const TsvRenderer tsv;
+    static const CsvRenderer csv;
+    static const JsonlRenderer jsonl;
+    switch (format) {
+    case OutputFormat::Compact: return compact;
+    case OutputFormat::Tsv:     return tsv;
+    case OutputFormat::Csv:     return csv;
+    case OutputFormat::Jsonl:   return jsonl;
+    default:                    return table;
+    }
+}
+
+void renderResult(OutputBuffer& buf, const PGresult* res) {
+    const ResultRenderer& renderer = rendererFor(currentFormat);
+    int rows = PQntuples(res);
+    std::vector<int> widths;
+    if (renderer.needsWidths()) {
+        widths = headerWidths(res);
+        for (int i = 0; i < rows; ++i) widenToRow(widths, res, i);
+    }
+    renderer.begin(buf, res, widths);
+    for (int i = 0; i < rows; ++i) renderer.row(buf, res, i, widths);
+    renderer.end(buf, widths);
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <libpq-fe.h>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Вывод результатов запросов. Отрисовщик читает ячейки прямо из PGresult
+// и дописывает их в один растущий буфер, который уходит в поток крупными
+// блоками, без промежуточных строк на каждую ячейку и отступ.
+
+// Форматы вывода: таблица с рамками, выровненные столбцы без рамок,
+// TSV (как COPY text), CSV и JSON Lines
+enum class OutputFormat {
+    Table,
+    Compact,
+    Tsv,
+    Csv,
+    Jsonl
+};
+
+// Формат по имени: table, compact, tsv, csv, jsonl
+bool parseOutputFormat(const std::string& name, OutputFormat& format);
+
+// Текущий формат вывода результатов
+void setOutputFormat(OutputFormat format);
+OutputFormat outputFormat();
+
+// Буфер вывода; сбрасывается в поток при заполнении и в деструкторе
+class OutputBuffer {
+public:
+    explicit OutputBuffer(std::ostream& os);
+    ~OutputBuffer();
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void append(const char* s, size_t len) {
+        data.append(s, len);
+        if (data.size() >= FLUSH_SIZE) flush();
+    }
+    void append(char c) {
+        data.push_back(c);
+    }
+    void fill(char c, int n) {
+        if (n > 0) data.append(static_cast<size_t>(n), c);
+    }
+    void flush();
+
+private:
+    static const size_t FLUSH_SIZE = 64 * 1024;
+
+    std::ostream& os;
+    std::string data;
+};
+
+// Ширина столбцов в знакоместах: по заголовкам, затем по строкам
+std::vector<int> headerWidths(const PGresult* res);
+void widenToRow(std::vector<int>& widths, const PGresult* res, int row);
+
+// Отрисовщик результата. При потоковом выводе строки приходят отдельными
+// результатами по одной (строка 0); ширина столбцов для форматов, которым
+// она нужна, считается по выборке первых строк.
+class ResultRenderer {
+public:
+    virtual ~ResultRenderer() = default;
+
+    // Нужна ли ширина столбцов до вывода первой строки
+    virtual bool needsWidths() const { return false; }
+
+    // Сообщение об успешной команде без строк результата
+    virtual void commandOk(OutputBuffer&) const {}
+
+    virtual void begin(OutputBuffer& buf, const PGresult* res,
+        const std::vector<int>& widths) const = 0;
+    virtual void row(OutputBuffer& buf, const PGresult* res, int row,
+        const std::vector<int>& widths) const = 0;
+    virtual void end(OutputBuffer& buf, const std::vector<int>& widths) const = 0;
+};
+
+const ResultRenderer& rendererFor(OutputFormat format);
+
+// Весь результат целиком текущим форматом
+void renderResult(OutputBuffer& buf, const PGresult* res);
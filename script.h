@@ -0,0 +1,19 @@
+#pragma once
+#include <libpq-fe.h>
+#include <iosfwd>
+
+// Пакетный режим: по одной операции в строке, в виде команды сервиса
+// (loan 1 2 2024-03-01) или объекта JSON Lines
+// ({"op": "loan", "args": [1, 2, "2024-03-01"]}). На каждую операцию
+// выводится строка «номер строки<TAB>ok|error[<TAB>значение]»; данные
+// операции (строки таблиц через табуляцию) идут следом с табуляцией в начале.
+struct ScriptOptions {
+    // Подряд идущие выдачи отправляются конвейером, возвраты с одной
+    // датой — одним запросом, не больше batchSize операций за раз
+    bool pipeline = false;
+    size_t batchSize = 256;
+};
+
+// Возвращает число операций, завершившихся ошибкой
+long long runScript(PGconn* conn, std::istream& input, std::ostream& output,
+    const ScriptOptions& opts);
@@ -0,0 +1,325 @@
+#include "service.h"
+#include "commands.h"
+#include "pool.h"
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static std::atomic<bool> stopRequested(false);
+
+// Канал пробуждения цикла опроса: в него пишут рабочие потоки по окончании
+// команды и обработчик сигнала остановки
+static int wakeWriteFd = -1;
+
+static void wakeLoop() {
+    char byte = 0;
+    ssize_t n = write(wakeWriteFd, &byte, 1);
+    (void)n;  // канал полон — цикл и так проснётся
+}
+
+static void onStopSignal(int) {
+    stopRequested = true;
+    wakeLoop();
+}
+
+// Команда клиента для рабочего потока
+struct Job {
+    int fd;
+    std::string line;
+};
+
+// Команда выполнена; keep — клиент продолжает сеанс
+struct JobDone {
+    int fd;
+    bool keep;
+};
+
+// Очередь команд для рабочих потоков. Команды одного клиента выполняются
+// по одной: следующая ставится в очередь после ответа на предыдущую.
+class JobQueue {
+public:
+    void push(Job job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        ready.notify_one();
+    }
+
+    // false, когда сервис останавливается
+    bool pop(Job& job) {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this] { return stopped || !jobs.empty(); });
+        if (stopped) return false;
+        job = std::move(jobs.front());
+        jobs.pop_front();
+        return true;
+    }
+
+    void complete(int fd, bool keep) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.push_back({ fd, keep });
+        }
+        wakeLoop();
+    }
+
+    std::vector<JobDone> takeCompleted() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<JobDone> result(done.begin(), done.end());
+        done.clear();
+        return result;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = true;
+        }
+        ready.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<Job> jobs;
+    std::deque<JobDone> done;
+    bool stopped = false;
+};
+
+static bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Ответ завершается строкой из одной точки; строки, начинающиеся
+// с точки, удваивают её (как в SMTP)
+static std::string frameResponse(const std::string& text) {
+    std::string framed;
+    framed.reserve(text.size() + 8);
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos) end = text.size();
+        if (text[pos] == '.') framed += '.';
+        framed.append(text, pos, end - pos);
+        framed += '\n';
+        pos = end + 1;
+    }
+    framed += ".\n";
+    return framed;
+}
+
+// Выполняет одну команду клиента и отправляет ответ; false — сеанс окончен
+static bool serveCommand(int fd, const std::string& line, ConnectionPool& pool) {
+    std::vector<std::string> words;
+    std::ostringstream output;
+    if (!splitCommandLine(line, words)) {
+        output << "Незакрытая кавычка в команде.\n";
+    }
+    else if (words.empty()) {
+        return true;
+    }
+    else if (words[0] == "quit") {
+        return false;
+    }
+    else if (words[0] == "help") {
+        printCommandHelp(output);
+    }
+    else {
+        // Подключение берётся только на время одной команды
+        PooledConnection conn(pool);
+        runCommand(conn.get(), words, output);
+    }
+    return sendAll(fd, frameResponse(output.str()));
+}
+
+// Клиент цикла опроса: принятые, но ещё не выполненные строки; пока
+// команда клиента выполняется (busy), сокет не читается
+struct Client {
+    std::string buffer;
+    bool busy = false;
+    bool eof = false;
+};
+
+static int openListener(const std::string& path) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Слишком длинный путь к сокету: " << path << std::endl;
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        std::cerr << "Ошибка создания сокета: " << std::strerror(errno) << std::endl;
+        return -1;
+    }
+
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        listen(fd, SOMAXCONN) < 0) {
+        std::cerr << "Ошибка открытия сокета " << path << ": "
+            << std::strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int runService(const std::string& connInfo, const ServiceOptions& options) {
+    std::unique_ptr<ConnectionPool> pool;
+    try {
+        pool.reset(new ConnectionPool(connInfo, options.poolSize));
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Ошибка: " << e.what() << std::endl;
+        return 1;
+    }
+
+    int listener = openListener(options.socketPath);
+    if (listener < 0) return 1;
+
+    int wake[2];
+    if (pipe(wake) < 0) {
+        std::cerr << "Ошибка создания канала: " << std::strerror(errno) << std::endl;
+        close(listener);
+        return 1;
+    }
+    fcntl(wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake[1], F_SETFL, O_NONBLOCK);
+    wakeWriteFd = wake[1];
+
+    // Без SA_RESTART сигнал прерывает poll, и цикл видит флаг остановки
+    struct sigaction sa {};
+    sa.sa_handler = onStopSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    // Рабочие потоки выполняют отдельные команды, а не целые сеансы:
+    // клиентов может быть больше, чем потоков, и простаивающий клиент
+    // поток не занимает
+    JobQueue jobs;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < options.workers; ++i) {
+        workers.emplace_back([&jobs, &pool] {
+            Job job;
+            while (jobs.pop(job)) {
+                jobs.complete(job.fd, serveCommand(job.fd, job.line, *pool));
+            }
+        });
+    }
+
+    std::cout << "Сервис слушает " << options.socketPath
+        << " (рабочих потоков: " << options.workers
+        << ", подключений: " << pool->size() << ")" << std::endl;
+
+    std::map<int, Client> clients;
+
+    auto closeClient = [&clients](int fd) {
+        clients.erase(fd);
+        close(fd);
+    };
+
+    // Следующая целая строка клиента уходит рабочим потокам; после конца
+    // ввода и последней команды клиент закрывается
+    auto dispatch = [&clients, &jobs, &closeClient](int fd) {
+        Client& c = clients[fd];
+        if (c.busy) return;
+        size_t eol = c.buffer.find('\n');
+        if (eol != std::string::npos) {
+            c.busy = true;
+            jobs.push({ fd, c.buffer.substr(0, eol) });
+            c.buffer.erase(0, eol + 1);
+        }
+        else if (c.eof) {
+            closeClient(fd);
+        }
+    };
+
+    std::vector<pollfd> fds;
+    char chunk[4096];
+    while (!stopRequested) {
+        fds.clear();
+        fds.push_back({ wake[0], POLLIN, 0 });
+        fds.push_back({ listener, POLLIN, 0 });
+        for (const auto& c : clients) {
+            if (!c.second.busy && !c.second.eof) fds.push_back({ c.first, POLLIN, 0 });
+        }
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Ошибка poll: " << std::strerror(errno) << std::endl;
+            break;
+        }
+
+        if (fds[0].revents != 0) {
+            while (read(wake[0], chunk, sizeof(chunk)) > 0) {}
+            for (const auto& done : jobs.takeCompleted()) {
+                clients[done.fd].busy = false;
+                if (done.keep) dispatch(done.fd);
+                else closeClient(done.fd);
+            }
+        }
+
+        if (fds[1].revents != 0) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd >= 0) {
+                clients[fd];
+            }
+            else if (errno != EINTR && errno != EAGAIN) {
+                std::cerr << "Ошибка accept: " << std::strerror(errno) << std::endl;
+                break;
+            }
+        }
+
+        for (size_t i = 2; i < fds.size(); ++i) {
+            if (fds[i].revents == 0) continue;
+            int fd = fds[i].fd;
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n < 0 && errno == EINTR) continue;
+            Client& c = clients[fd];
+            if (n <= 0) c.eof = true;
+            else c.buffer.append(chunk, static_cast<size_t>(n));
+            dispatch(fd);
+        }
+    }
+
+    // Прерывает отправку ответов, затем ждёт команды, которые уже выполняются
+    for (const auto& c : clients) shutdown(c.first, SHUT_RDWR);
+    jobs.stop();
+    for (auto& t : workers) t.join();
+    for (const auto& c : clients) close(c.first);
+    wakeWriteFd = -1;
+    close(wake[0]);
+    close(wake[1]);
+    close(listener);
+    unlink(options.socketPath.c_str());
+    std::cout << "Сервис остановлен." << std::endl;
+    return 0;
+}
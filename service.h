@@ -0,0 +1,16 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Режим сервиса: локальный сокет, по которому клиенты присылают команды
+// (по одной в строке, см. commands.h). Сокеты клиентов опрашивает один
+// поток, готовые команды выполняет пул рабочих потоков (по одной команде
+// клиента за раз), запросы к базе идут через общий пул подключений.
+struct ServiceOptions {
+    std::string socketPath;
+    size_t workers;
+    size_t poolSize;
+};
+
+// Работает до SIGINT/SIGTERM; возвращает код завершения процесса
+int runService(const std::string& connInfo, const ServiceOptions& options);
@@ -0,0 +1,442 @@
+// Нагрузочная проверка выдач, возвратов и списания экземпляров.
+// Несколько потоков, каждый со своим подключением, выполняют смесь выдач,
+// возвратов и списаний по небольшому набору популярных книг, так что
+// операции постоянно сталкиваются на одних строках. Запросы повторяются
+// при конфликте сериализации (40001) и взаимоблокировке (40P01); число
+// повторов, задержки и пропускная способность выводятся по каждой операции.
+// В конце проверяется инвариант: у каждой книги свободно ровно
+// copies_total − число открытых выдач.
+//
+// Прогон меняет данные (выдачи, списания, добавленные экземпляры) и не
+// откатывает их, поэтому база задаётся явно: --dsn, настройки lab6 не
+// используются.
+//
+// Запуск: ./stress --dsn "dbname=library_scratch" --threads 16 --operations 5000
+#include "database.h"
+#include "migrations.h"
+#include "pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Дата выдач и возвратов: порядок дат инварианту не важен
+static const char* const STRESS_DATE = "2024-06-01";
+
+// Сколько раз повторять запрос после конфликта
+const int MAX_RETRIES = 20;
+
+struct StressOptions {
+    int threads = 8;
+    int operations = 2000;        // операций на поток
+    int mix[3] = { 50, 40, 10 };  // доли выдач, возвратов и списаний
+    int books = 20;               // популярных книг, по которым идёт нагрузка
+    int copies = 20;              // экземпляров, добавляемых каждой из них
+    bool serializable = false;
+    unsigned long long seed = 42;
+};
+
+enum StressOp { OP_LOAN, OP_RETURN, OP_REMOVE, OP_COUNT };
+
+static const char* const OP_NAMES[OP_COUNT] = { "loan", "return", "delete-copy" };
+
+// Итоги одной операции в одном потоке; refused — отказ по правилам
+// (нет экземпляров, нечего списать), а не ошибка
+struct OpStats {
+    std::vector<double> latencies;  // мкс, вместе с повторами
+    int ok = 0;
+    int refused = 0;
+    int errors = 0;
+    int serializationRetries = 0;
+    int deadlockRetries = 0;
+    std::string firstError;
+
+    void merge(const OpStats& o) {
+        latencies.insert(latencies.end(), o.latencies.begin(), o.latencies.end());
+        ok += o.ok;
+        refused += o.refused;
+        errors += o.errors;
+        serializationRetries += o.serializationRetries;
+        deadlockRetries += o.deadlockRetries;
+        if (firstError.empty()) firstError = o.firstError;
+    }
+};
+
+// Поток, который только отбрасывает вывод
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return traits_type::not_eof(c); }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+static bool hasState(const PGresult* res, const char* state) {
+    const char* s = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+    return s != nullptr && std::strcmp(s, state) == 0;
+}
+
+// Выполняет подготовленный запрос, повторяя его после конфликта
+// сериализации или взаимоблокировки с растущей случайной паузой
+static PGresult* execWithRetry(PGconn* conn, const char* name, const QueryParams& params,
+    OpStats& stats, std::mt19937_64& rng) {
+    for (int attempt = 0; ; ++attempt) {
+        PGresult* res = execPrepared(conn, name, params, BINARY_FORMAT);
+        bool serialization = hasState(res, "40001");
+        bool deadlock = hasState(res, "40P01");
+        if ((!serialization && !deadlock) || attempt >= MAX_RETRIES) return res;
+        PQclear(res);
+        if (serialization) ++stats.serializationRetries;
+        else ++stats.deadlockRetries;
+        int limit = 50 << std::min(attempt, 6);
+        std::this_thread::sleep_for(std::chrono::microseconds(
+            std::uniform_int_distribution<int>(0, limit)(rng)));
+    }
+}
+
+static void fail(OpStats& stats, const PGresult* res) {
+    ++stats.errors;
+    if (stats.firstError.empty()) stats.firstError = PQresultErrorMessage(res);
+}
+
+struct Worker {
+    PGconn* conn;
+    std::mt19937_64 rng;
+    const std::vector<int>* books;
+    int readers;
+    std::vector<int> loans;  // открытые выдачи, которые возвращает только этот поток
+    OpStats stats[OP_COUNT];
+
+    void loan() {
+        int book = (*books)[std::uniform_int_distribution<size_t>(0, books->size() - 1)(rng)];
+        int reader = std::uniform_int_distribution<int>(1, readers)(rng);
+        OpStats& s = stats[OP_LOAN];
+        PGresult* res = execWithRetry(conn, "loan_issue",
+            QueryParams().add(book).add(reader).add(std::string(STRESS_DATE)), s, rng);
+
+        int32_t status;
+        std::optional<int32_t> id;
+        if (PQresultStatus(res) != PGRES_TUPLES_OK || !readRow(res, 0, status, id)) {
+            fail(s, res);
+        }
+        else if (status == 0 && id) {
+            ++s.ok;
+            loans.push_back(*id);
+        }
+        else {
+            ++s.refused;
+        }
+        PQclear(res);
+    }
+
+    void giveBack() {
+        size_t i = std::uniform_int_distribution<size_t>(0, loans.size() - 1)(rng);
+        int loanId = loans[i];
+        loans[i] = loans.back();
+        loans.pop_back();
+
+        OpStats& s = stats[OP_RETURN];
+        PGresult* res = execWithRetry(conn, "loans_return",
+            QueryParams().add(std::vector<int32_t>{ loanId }).add(std::string(STRESS_DATE)),
+            s, rng);
+
+        int32_t id;
+        bool returned;
+        std::optional<int32_t> holdLoanId;
+        if (PQresultStatus(res) != PGRES_TUPLES_OK ||
+            !readRow(res, 0, id, returned, holdLoanId)) {
+            fail(s, res);
+            loans.push_back(loanId);
+        }
+        else if (returned) {
+            ++s.ok;
+            // Экземпляр передан очереди ожидания: новая выдача тоже в игре
+            if (holdLoanId) loans.push_back(*holdLoanId);
+        }
+        else {
+            // Выдачу возвращает только этот поток, значит она потерялась
+            ++s.errors;
+            if (s.firstError.empty()) {
+                s.firstError = "выдача " + std::to_string(loanId) + " уже закрыта\n";
+            }
+        }
+        PQclear(res);
+    }
+
+    void removeCopy() {
+        int book = (*books)[std::uniform_int_distribution<size_t>(0, books->size() - 1)(rng)];
+        OpStats& s = stats[OP_REMOVE];
+        PGresult* res = execWithRetry(conn, "book_remove_copies",
+            QueryParams().add(book).add(1), s, rng);
+
+        int32_t status;
+        std::optional<int32_t> total, available;
+        if (hasState(res, "23503")) {
+            // Последний экземпляр книги с историей выдач не удаляется
+            ++s.refused;
+        }
+        else if (PQresultStatus(res) != PGRES_TUPLES_OK ||
+            !readRow(res, 0, status, total, available)) {
+            fail(s, res);
+        }
+        else if (status == 0 || status == 3) {
+            ++s.ok;
+        }
+        else {
+            ++s.refused;
+        }
+        PQclear(res);
+    }
+
+    void run(const StressOptions& opts) {
+        NullBuffer null;
+        std::ostream output(&null);
+        std::istringstream input;
+        SessionScope scope(input, output, output);
+
+        int total = opts.mix[0] + opts.mix[1] + opts.mix[2];
+        for (int i = 0; i < opts.operations; ++i) {
+            int roll = std::uniform_int_distribution<int>(0, total - 1)(rng);
+            StressOp op = roll < opts.mix[0] ? OP_LOAN
+                : roll < opts.mix[0] + opts.mix[1] ? OP_RETURN : OP_REMOVE;
+            if (op == OP_RETURN && loans.empty()) op = OP_LOAN;
+
+            auto start = std::chrono::steady_clock::now();
+            switch (op) {
+            case OP_LOAN:   loan();       break;
+            case OP_RETURN: giveBack();   break;
+            default:        removeCopy(); break;
+            }
+            auto end = std::chrono::steady_clock::now();
+            stats[op].latencies.push_back(
+                std::chrono::duration<double, std::micro>(end - start).count());
+        }
+    }
+};
+
+// Перцентиль по ближайшему рангу; latencies отсортированы
+static double percentile(const std::vector<double>& latencies, double p) {
+    if (latencies.empty()) return 0;
+    size_t rank = static_cast<size_t>(std::ceil(p * latencies.size()));
+    return latencies[std::min(std::max<size_t>(rank, 1), latencies.size()) - 1];
+}
+
+static std::vector<int> queryIds(PGconn* conn, const char* sql, const QueryParams& params) {
+    PGresult* res = PQexecParams(conn, sql, params.size(), nullptr, params.values(),
+        params.lengths(), params.formats(), BINARY_FORMAT);
+    std::vector<int> ids;
+    if (PQresultStatus(res) == PGRES_TUPLES_OK) {
+        for (int i = 0; i < PQntuples(res); ++i) {
+            int32_t id;
+            if (readRow(res, i, id)) ids.push_back(id);
+        }
+    }
+    else {
+        std::cerr << "Ошибка: " << PQresultErrorMessage(res) << std::endl;
+    }
+    PQclear(res);
+    return ids;
+}
+
+// Книги, у которых свободных экземпляров не столько, сколько не выдано;
+// возвращает число таких книг
+static int checkInvariant(PGconn* conn, bool print) {
+    PGresult* res = PQexec(conn,
+        "SELECT b.book_id, b.copies_total, b.copies_available, "
+        "       COALESCE(o.open, 0) AS open_loans "
+        "FROM books b "
+        "LEFT JOIN (SELECT book_id, COUNT(*)::int AS open "
+        "           FROM loans WHERE return_date IS NULL "
+        "           GROUP BY book_id) o ON o.book_id = b.book_id "
+        "WHERE b.copies_available <> b.copies_total - COALESCE(o.open, 0) "
+        "   OR b.copies_available < 0 "
+        "ORDER BY b.book_id;");
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        std::cerr << "Ошибка проверки инварианта: " << PQresultErrorMessage(res) << std::endl;
+        PQclear(res);
+        return -1;
+    }
+    int broken = PQntuples(res);
+    if (broken > 0 && print) printResult(res);
+    PQclear(res);
+    return broken;
+}
+
+static void printSummary(const std::vector<OpStats>& results, double wallSeconds) {
+    std::vector<std::vector<std::string>> rows;
+    auto fixed = [](double v) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.1f", v);
+        return std::string(buf);
+    };
+    for (int op = 0; op < OP_COUNT; ++op) {
+        const OpStats& r = results[op];
+        rows.push_back({ OP_NAMES[op], std::to_string(r.latencies.size()),
+            std::to_string(r.ok), std::to_string(r.refused), std::to_string(r.errors),
+            std::to_string(r.serializationRetries), std::to_string(r.deadlockRetries),
+            fixed(percentile(r.latencies, 0.50)), fixed(percentile(r.latencies, 0.99)),
+            fixed(wallSeconds > 0 ? r.latencies.size() / wallSeconds : 0) });
+    }
+    PGresult* res = makeTextResult({ "операция", "n", "успешно", "отказов", "ошибок",
+        "повторов 40001", "повторов 40P01", "p50 мкс", "p99 мкс", "оп/с" }, rows);
+    printResult(res);
+    PQclear(res);
+}
+
+static void printUsage(const char* program) {
+    std::cout << "Использование: " << program << " --dsn СТРОКА [параметры]\n"
+        << "  --dsn СТРОКА      подключение к отдельной базе для проверки; её данные\n"
+        << "                    изменяются и не восстанавливаются\n"
+        << "  --threads N       потоков, каждый со своим подключением (8)\n"
+        << "  --operations N    операций на поток (2000)\n"
+        << "  --mix L,R,D       доли выдач, возвратов и списаний (50,40,10)\n"
+        << "  --books N         популярных книг под нагрузкой (20)\n"
+        << "  --copies N        экземпляров, добавляемых каждой из них (20)\n"
+        << "  --serializable    транзакции с уровнем изоляции SERIALIZABLE\n"
+        << "  --seed N          зерно генератора\n";
+}
+
+static bool parseMix(const std::string& s, int (&mix)[3]) {
+    std::stringstream list(s);
+    std::string part;
+    int n = 0;
+    while (std::getline(list, part, ',')) {
+        if (n == 3) return false;
+        mix[n++] = std::max(0, std::atoi(part.c_str()));
+    }
+    return n == 3 && mix[0] + mix[1] + mix[2] > 0;
+}
+
+int main(int argc, char** argv) {
+    StressOptions opts;
+    std::string connInfo;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (arg == "--dsn" && hasValue) connInfo = argv[++i];
+        else if (arg == "--threads" && hasValue) opts.threads = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--operations" && hasValue) opts.operations = std::atoi(argv[++i]);
+        else if (arg == "--books" && hasValue) opts.books = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--copies" && hasValue) opts.copies = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--serializable") opts.serializable = true;
+        else if (arg == "--seed" && hasValue) opts.seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--mix" && hasValue && parseMix(argv[++i], opts.mix)) continue;
+        else {
+            printUsage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    if (connInfo.empty()) {
+        std::cerr << "Укажите базу для проверки: --dsn СТРОКА. Прогон изменяет данные "
+            "и не восстанавливает их, рабочую базу использовать нельзя." << std::endl;
+        return 1;
+    }
+
+    // Уровень изоляции задаётся для всех подключений, в том числе
+    // восстановленных после обрыва
+    if (opts.serializable) setenv("PGOPTIONS", "-c default_transaction_isolation=serializable", 1);
+
+    PGconn* conn = openConnection(connInfo);
+    if (conn == nullptr) return 1;
+    if (!applyMigrations(conn)) {
+        PQfinish(conn);
+        return 1;
+    }
+
+    int before = checkInvariant(conn, false);
+    if (before > 0) {
+        std::cout << "Внимание: инвариант нарушен ещё до прогона у книг: " << before << "\n";
+    }
+
+    // Популярные книги получают запас экземпляров, чтобы выдачи и списания
+    // шли до конца прогона
+    std::vector<int> books = queryIds(conn,
+        "UPDATE books "
+        "SET copies_total = copies_total + $2::int, "
+        "    copies_available = copies_available + $2::int "
+        "WHERE book_id IN (SELECT book_id FROM books ORDER BY book_id LIMIT $1::int) "
+        "RETURNING book_id;",
+        QueryParams().add(opts.books).add(opts.copies));
+    std::vector<int> open = queryIds(conn,
+        "SELECT loan_id FROM loans "
+        "WHERE return_date IS NULL AND book_id = ANY($1::int[]) "
+        "ORDER BY loan_id;",
+        QueryParams().add(books));
+    std::vector<int> readers = queryIds(conn,
+        "SELECT COALESCE(MAX(reader_id), 0) FROM readers;", QueryParams());
+    if (books.empty() || readers.empty() || readers[0] == 0) {
+        std::cerr << "В базе нет книг или читателей: заполните её, например ./bench --dsn СТРОКА --generate N"
+            << std::endl;
+        PQfinish(conn);
+        return 1;
+    }
+
+    std::vector<Worker> workers(opts.threads);
+    for (int t = 0; t < opts.threads; ++t) {
+        Worker& w = workers[t];
+        w.conn = openConnection(connInfo);
+        if (w.conn == nullptr) {
+            for (int j = 0; j < t; ++j) PQfinish(workers[j].conn);
+            PQfinish(conn);
+            return 1;
+        }
+        w.rng.seed(opts.seed + t);
+        w.books = &books;
+        w.readers = readers[0];
+    }
+    // Открытые выдачи распределяются между потоками поровну
+    for (size_t i = 0; i < open.size(); ++i) workers[i % workers.size()].loans.push_back(open[i]);
+
+    std::cout << "Потоков " << opts.threads << ", операций на поток " << opts.operations
+        << ", книг " << books.size() << ", смесь " << opts.mix[0] << "/" << opts.mix[1]
+        << "/" << opts.mix[2] << (opts.serializable ? ", SERIALIZABLE" : "") << "\n";
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (auto& w : workers) {
+        threads.emplace_back([&w, &opts]() { w.run(opts); });
+    }
+    for (auto& th : threads) th.join();
+    double wallSeconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<OpStats> results(OP_COUNT);
+    int errors = 0;
+    for (auto& w : workers) {
+        for (int op = 0; op < OP_COUNT; ++op) results[op].merge(w.stats[op]);
+        PQfinish(w.conn);
+    }
+    for (auto& r : results) {
+        std::sort(r.latencies.begin(), r.latencies.end());
+        errors += r.errors;
+    }
+
+    printSummary(results, wallSeconds);
+    long long total = 0;
+    for (const auto& r : results) total += static_cast<long long>(r.latencies.size());
+    std::cout << "Всего " << total << " операций за " << wallSeconds << " с: "
+        << (wallSeconds > 0 ? total / wallSeconds : 0) << " оп/с\n";
+    for (int op = 0; op < OP_COUNT; ++op) {
+        if (!results[op].firstError.empty()) {
+            std::cout << "Первая ошибка " << OP_NAMES[op] << ": " << results[op].firstError;
+        }
+    }
+
+    int after = checkInvariant(conn, true);
+    PQfinish(conn);
+    if (after == 0) {
+        std::cout << "Инвариант выполнен: copies_available = copies_total - открытые выдачи.\n";
+    }
+    else if (after > 0) {
+        std::cout << "Инвариант нарушен у книг: " << after << "\n";
+    }
+    return (after == 0 && errors == 0) ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+#include "textwidth.h"
+#include <bitset>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTWIDTH_SSE2 1
+#endif
+
+static bool isContinuation(unsigned char b) {
+    return (b & 0xC0) == 0x80;
+}
+
+static int codePointWidth(unsigned int cp) {
+    // Комбинирующие знаки
+    if ((cp >= 0x0300 && cp <= 0x036F) ||
+        (cp >= 0x0483 && cp <= 0x0489) ||
+        (cp >= 0x1AB0 && cp <= 0x1AFF) ||
+        (cp >= 0x1DC0 && cp <= 0x1DFF) ||
+        (cp >= 0x200B && cp <= 0x200F) ||
+        (cp >= 0x20D0 && cp <= 0x20FF) ||
+        (cp >= 0xFE20 && cp <= 0xFE2F)) {
+        return 0;
+    }
+    // Широкие символы Восточной Азии
+    if ((cp >= 0x1100 && cp <= 0x115F) ||
+        (cp >= 0x2E80 && cp <= 0xA4CF) ||
+        (cp >= 0xAC00 && cp <= 0xD7A3) ||
+        (cp >= 0xF900 && cp <= 0xFAFF) ||
+        (cp >= 0xFE30 && cp <= 0xFE4F) ||
+        (cp >= 0xFF00 && cp <= 0xFF60) ||
+        (cp >= 0xFFE0 && cp <= 0xFFE6) ||
+        (cp >= 0x1F300 && cp <= 0x1F64F) ||
+        (cp >= 0x20000 && cp <= 0x3FFFD)) {
+        return 2;
+    }
+    return 1;
+}
+
+// Разбор одной кодовой точки начиная с s[i]; сдвигает i за неё.
+// Некорректная последовательность считается одним символом шириной 1.
+static int scalarStep(const unsigned char* s, size_t len, size_t& i) {
+    unsigned char b = s[i];
+    if (b < 0x80) {
+        ++i;
+        return 1;
+    }
+
+    int extra;
+    unsigned int cp;
+    if (b >= 0xF0 && b <= 0xF4) { extra = 3; cp = b & 0x07; }
+    else if (b >= 0xE0) { extra = 2; cp = b & 0x0F; }
+    else if (b >= 0xC2 && b < 0xE0) { extra = 1; cp = b & 0x1F; }
+    else {
+        ++i;
+        return 1;
+    }
+
+    if (i + extra >= len) {
+        i = len;
+        return 1;
+    }
+    for (int k = 1; k <= extra; ++k) {
+        unsigned char c = s[i + k];
+        if (!isContinuation(c)) {
+            i += k;
+            return 1;
+        }
+        cp = (cp << 6) | (c & 0x3F);
+    }
+    i += extra + 1;
+    return codePointWidth(cp);
+}
+
+int displayWidth(const char* str, size_t len) {
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(str);
+    size_t i = 0;
+    int width = 0;
+
+#ifdef TEXTWIDTH_SSE2
+    const __m128i contLimit = _mm_set1_epi8(-64);               // 0xC0
+    const __m128i leadMask = _mm_set1_epi8(static_cast<char>(0xFE));
+    const __m128i cyrLead = _mm_set1_epi8(static_cast<char>(0xD0));
+
+    while (i + 16 <= len) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        int high = _mm_movemask_epi8(v);
+        if (high == 0) {
+            width += 16;
+            i += 16;
+            continue;
+        }
+
+        // Байты 0x80..0xBF — продолжения, в знаковом виде они меньше -64
+        int cont = _mm_movemask_epi8(_mm_cmplt_epi8(v, contLimit));
+        int lead = high & ~cont;
+        // Ведущие байты 0xD0/0xD1 — кириллица U+0400..U+047F, ширина 1
+        int cyr = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(v, leadMask), cyrLead));
+        if ((lead & ~cyr) == 0) {
+            width += 16 - static_cast<int>(std::bitset<16>(cont).count());
+            i += 16;
+            continue;
+        }
+
+        // Прочие символы: посимвольный разбор до конца блока. Продолжения
+        // в начале блока относятся к символу, уже учтённому в прошлом блоке.
+        size_t end = i + 16;
+        while (i < end && isContinuation(s[i])) ++i;
+        while (i < end) width += scalarStep(s, len, i);
+    }
+#endif
+
+    while (i < len && isContinuation(s[i])) ++i;
+    while (i < len) width += scalarStep(s, len, i);
+    return width;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Ширина строки UTF-8 в знакоместах терминала без выделения памяти.
+// Комбинирующие символы не занимают места, широкие (CJK и т.п.) занимают
+// два знакоместа, остальные кодовые точки — одно. Непрерывные участки
+// ASCII и базовой кириллицы считаются векторно (SSE2) по 16 байт.
+int displayWidth(const char* s, size_t len);
+
+inline int displayWidth(const std::string& s) {
+    return displayWidth(s.data(), s.size());
+}